@@ -0,0 +1,43 @@
+#include "arena.hpp"
+
+#include <algorithm>
+#include <cstdint>
+
+inline auto addBlock(Arena& arena, const std::size_t bytes) -> void {
+	arena.blocks.push_back(std::make_unique<std::byte[]>(bytes));
+	arena.head = arena.blocks.back().get();
+	arena.remaining = bytes;
+}
+
+auto beginArena(Arena& arena) -> void {
+	for (auto& block : arena.blocks) {
+		arena.retired.push_back(std::move(block));
+	}
+	arena.blocks.clear();
+
+	addBlock(arena, std::max(arena.used, ArenaBlockSize));
+	arena.used = 0;
+}
+
+auto endArena(Arena& arena) -> void {
+	arena.retired.clear();
+}
+
+auto arenaAllocate(Arena& arena,
+				   const std::size_t bytes,
+				   const std::size_t alignment) -> void* {
+	const auto addr = reinterpret_cast<std::uintptr_t>(arena.head);
+	auto padding = (alignment - addr % alignment) % alignment;
+
+	if (arena.head == nullptr || padding + bytes > arena.remaining) {
+		addBlock(arena, std::max(bytes + alignment, ArenaBlockSize));
+		const auto blockAddr = reinterpret_cast<std::uintptr_t>(arena.head);
+		padding = (alignment - blockAddr % alignment) % alignment;
+	}
+
+	auto* const ptr = arena.head + padding;
+	arena.head += padding + bytes;
+	arena.remaining -= padding + bytes;
+	arena.used += padding + bytes;
+	return ptr;
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+constexpr auto ArenaBlockSize = std::size_t{1} << 20;
+
+// One instance's buffers, bump allocated out of as few blocks as possible.
+// Nothing is freed on its own; prepareToPlay starts a new generation with
+// beginArena, rebuilds every buffer from it, then drops the old generation
+// with endArena. The first block of a generation is sized to everything the
+// last one used, so from the second prepare on it is a single allocation.
+struct Arena {
+	std::vector<std::unique_ptr<std::byte[]>> blocks;
+	std::vector<std::unique_ptr<std::byte[]>> retired;
+	std::byte* head = nullptr;
+	std::size_t remaining = 0;
+	std::size_t used = 0;
+};
+
+auto beginArena(Arena& arena) -> void;
+auto endArena(Arena& arena) -> void;
+auto arenaAllocate(Arena& arena, std::size_t bytes, std::size_t alignment)
+	-> void*;
+
+// Hands out arena memory to standard containers. A default constructed
+// allocator has no arena and falls back to the heap, so containers that were
+// never prepared still work. The allocator moves with the container, which is
+// how assigning a fresh arenaVector puts an existing member in the arena.
+template <typename T>
+struct ArenaAllocator {
+	using value_type = T;
+	using propagate_on_container_copy_assignment = std::true_type;
+	using propagate_on_container_move_assignment = std::true_type;
+	using propagate_on_container_swap = std::true_type;
+
+	Arena* arena = nullptr;
+
+	ArenaAllocator() = default;
+	explicit ArenaAllocator(Arena* arena) : arena{arena} {}
+	template <typename U>
+	ArenaAllocator(const ArenaAllocator<U>& other) : arena{other.arena} {}
+
+	auto allocate(const std::size_t n) -> T* {
+		if (arena == nullptr) {
+			return std::allocator<T>{}.allocate(n);
+		}
+		return static_cast<T*>(
+			arenaAllocate(*arena, n * sizeof(T), alignof(T)));
+	}
+
+	auto deallocate(T* ptr, const std::size_t n) -> void {
+		if (arena == nullptr) {
+			std::allocator<T>{}.deallocate(ptr, n);
+		}
+	}
+
+	template <typename U>
+	auto operator==(const ArenaAllocator<U>& other) const -> bool {
+		return arena == other.arena;
+	}
+};
+
+template <typename T>
+using ArenaVector = std::vector<T, ArenaAllocator<T>>;
+
+// A new vector of `size` value initialised elements with room for
+// `capacity`, all in the arena's current generation.
+template <typename T>
+auto arenaVector(Arena& arena, const std::size_t size, std::size_t capacity = 0)
+	-> ArenaVector<T> {
+	auto vec = ArenaVector<T>{ArenaAllocator<T>{&arena}};
+	vec.reserve(std::max(size, capacity));
+	vec.resize(size);
+	return vec;
+}
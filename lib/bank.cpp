@@ -0,0 +1,167 @@
+#include "bank.hpp"
+#include "engine.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <tuple>
+
+// The only join on the builder's thread. A build in progress stops at its
+// next sequence once `exit` is set.
+BankBuilder::~BankBuilder() {
+	{
+		const auto lock = std::lock_guard{mutex};
+		exit.store(true);
+	}
+	cv.notify_one();
+
+	if (thread.joinable()) {
+		thread.join();
+	}
+}
+
+auto bankBuilder() -> BankBuilder& {
+	static auto builder = BankBuilder{};
+	return builder;
+}
+
+inline auto bankIndex(const int steps, const int point) -> int {
+	return (steps - MinSteps) * BankAlphaPoints + point;
+}
+
+inline auto bankAlpha(const int point) -> std::int32_t {
+	return quantizeAlpha((float)point / (BankAlphaPoints - 1));
+}
+
+auto buildBank(BankBuilder& builder,
+			   const std::uint64_t seed,
+			   const SequenceMaker make)
+	-> std::shared_ptr<const ParameterBank> {
+	auto bank = std::make_shared<ParameterBank>();
+	bank->seed = seed;
+	bank->sequences.reserve((MaxSteps - MinSteps + 1) * BankAlphaPoints);
+
+	// Each grid point is made with the same alpha for the offsets and the
+	// gains, so it can stand in for either
+	for (auto steps = MinSteps; steps <= MaxSteps; ++steps) {
+		for (auto point = 0; point < BankAlphaPoints; ++point) {
+			if (builder.exit.load()) {
+				return nullptr;
+			}
+			const auto alpha = bankAlpha(point);
+			bank->sequences.push_back(
+				std::make_shared<const FractalNoiseResult>(
+					make({steps, alpha, alpha, seed})));
+		}
+	}
+	return bank;
+}
+
+// Builds whatever is queued, one seed after another, until the builder goes
+auto runBankBuilder(BankBuilder& builder) -> void {
+	auto lock = std::unique_lock{builder.mutex};
+	while (true) {
+		builder.cv.wait(lock, [&builder] {
+			return builder.exit.load() || builder.queued;
+		});
+		if (builder.exit.load()) {
+			return;
+		}
+
+		const auto seed = builder.queuedSeed;
+		const auto make = builder.queuedMake;
+		builder.queued = false;
+		builder.building = true;
+		builder.buildingSeed = seed;
+		lock.unlock();
+
+		auto bank = buildBank(builder, seed, make);
+
+		lock.lock();
+		builder.building = false;
+		if (bank) {
+			builder.bank = std::move(bank);
+		}
+	}
+}
+
+auto acquireBank(BankBuilder& builder,
+				 const std::uint64_t seed,
+				 const SequenceMaker make)
+	-> std::shared_ptr<const ParameterBank> {
+	{
+		const auto lock = std::lock_guard{builder.mutex};
+		if (builder.bank && builder.bank->seed == seed) {
+			return builder.bank;
+		}
+		if ((builder.building && builder.buildingSeed == seed) ||
+			(builder.queued && builder.queuedSeed == seed)) {
+			return nullptr;
+		}
+
+		builder.queued = true;
+		builder.queuedSeed = seed;
+		builder.queuedMake = make;
+		if (!builder.thread.joinable()) {
+			builder.thread =
+				std::thread{[&builder] { runBankBuilder(builder); }};
+		}
+	}
+	builder.cv.notify_one();
+	return nullptr;
+}
+
+// Both neighbours are on the same steps and seed, so step i of one lines up
+// with step i of the other
+inline auto lerpLanes(const std::vector<std::vector<float>>& lo,
+					  const std::vector<std::vector<float>>& hi,
+					  const float t) -> std::vector<std::vector<float>> {
+	auto lanes = lo;
+	for (auto lane = std::size_t{0}; lane < lanes.size(); ++lane) {
+		for (auto i = std::size_t{0}; i < lanes[lane].size(); ++i) {
+			lanes[lane][i] += (hi[lane][i] - lo[lane][i]) * t;
+		}
+	}
+	return lanes;
+}
+
+// The two grid points either side of `alpha` and how far it is from the first
+inline auto neighbours(const ParameterBank& bank,
+					   const int steps,
+					   const std::int32_t alpha)
+	-> std::tuple<const FractalNoiseResult&, const FractalNoiseResult&, float> {
+	const auto pos = std::clamp(alphaFromKey(alpha), 0.f, 1.f) *
+					 (BankAlphaPoints - 1);
+	const auto point = std::min((int)pos, BankAlphaPoints - 2);
+	return {*bank.sequences[bankIndex(steps, point)],
+			*bank.sequences[bankIndex(steps, point + 1)], pos - (float)point};
+}
+
+auto sequenceFromBank(const ParameterBank& bank, const SequenceKey& key)
+	-> FractalNoiseResult {
+	const auto [lo, hi, t] = neighbours(bank, key.steps, key.alpha);
+	const auto [gainsLo, gainsHi, gainsT] =
+		neighbours(bank, key.steps, key.dynamicsAlpha);
+
+	auto res = FractalNoiseResult{};
+	res.steps = lo.steps;
+	res.frequencies = lo.frequencies;
+	res.spectrum = lo.spectrum;
+	for (auto i = std::size_t{0}; i < res.spectrum.size(); ++i) {
+		res.spectrum[i] += (hi.spectrum[i] - lo.spectrum[i]) * t;
+	}
+
+	res.laneOffsets = lerpLanes(lo.laneOffsets, hi.laneOffsets, t);
+	res.laneGains = lerpLanes(gainsLo.laneGains, gainsHi.laneGains, gainsT);
+	for (const auto& lane : res.laneOffsets) {
+		res.laneMinOffsets.push_back(std::ranges::min(lane));
+	}
+
+	res.offsets = res.laneOffsets[0];
+	res.minOffset = res.laneMinOffsets[0];
+	const auto range = std::ranges::max(res.offsets) - res.minOffset;
+	for (const auto val : res.offsets) {
+		res.normOffsets.push_back((val - res.minOffset) / range);
+	}
+
+	return res;
+}
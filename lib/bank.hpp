@@ -0,0 +1,54 @@
+#pragma once
+
+#include "sequences.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+constexpr auto BankAlphaPoints = 33;
+
+// A sequence for every step count at BankAlphaPoints alphas spread evenly over
+// the knob, all from one seed. Any other alpha is interpolated between the two
+// nearest, so once the bank is built the editor can follow a knob without an
+// FFT. Interpolated offsets land within 1e-4 samples of the exact ones, but a
+// key has to map to one table wherever it's loaded, so they're only drawn.
+struct ParameterBank {
+	std::uint64_t seed = 0;
+	std::vector<SequenceHandle> sequences;
+};
+
+// Builds banks on its own thread, once per seed per process. A build always
+// runs to the end; a request for another seed meanwhile waits behind it, and
+// only the latest such request is kept, so the builder never falls more than
+// one seed behind and nobody waits on a thread to stop.
+struct BankBuilder {
+	std::mutex mutex;
+	std::condition_variable cv;
+	std::thread thread;
+	std::atomic<bool> exit = false;
+	bool building = false;
+	std::uint64_t buildingSeed = 0;
+	bool queued = false;
+	std::uint64_t queuedSeed = 0;
+	SequenceMaker queuedMake = nullptr;
+	std::shared_ptr<const ParameterBank> bank;
+
+	~BankBuilder();
+};
+
+auto bankBuilder() -> BankBuilder&;
+
+// The finished bank for `seed`, or null while it's still to be built. The
+// first call for a seed queues it to be built with `make`, in place of any
+// other seed still waiting. Only instances being edited ask for one, so the
+// bank follows whichever the user is working on. Never blocks on a build.
+auto acquireBank(BankBuilder& builder, std::uint64_t seed, SequenceMaker make)
+	-> std::shared_ptr<const ParameterBank>;
+
+auto sequenceFromBank(const ParameterBank& bank, const SequenceKey& key)
+	-> FractalNoiseResult;
@@ -0,0 +1,404 @@
+#include "delay.hpp"
+#include "engine.hpp"
+
+#include <juce_audio_basics/juce_audio_basics.h>
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstdint>
+#include <type_traits>
+
+using juce::FloatVectorOperations;
+
+// Blackman-windowed sinc, one row of FracTaps per phase. Row p delays by
+// FracTaps / 2 + p / FracPhases samples when its taps are written starting one
+// sample past the integer offset. Each row is normalised to unity gain at DC
+// so hits don't change level as they move between phases.
+auto buildFracTable(ArenaVector<float>& table) -> void {
+	for (auto phase = 0; phase < FracPhases; ++phase) {
+		auto* const row = table.data() + phase * FracTaps;
+		const auto frac = (double)phase / FracPhases;
+
+		auto sum = 0.0;
+		for (auto k = 0; k < FracTaps; ++k) {
+			const auto x = (double)(k + 1 - FracTaps / 2) - frac;
+			const auto sinc =
+				std::abs(x) < 1e-9 ? 1.0 : std::sin(M_PI * x) / (M_PI * x);
+			const auto w = (x + FracTaps / 2.0) / FracTaps;
+			const auto window = 0.42 - 0.5 * std::cos(2.0 * M_PI * w) +
+								0.08 * std::cos(4.0 * M_PI * w);
+			row[k] = (float)(sinc * window);
+			sum += row[k];
+		}
+
+		for (auto k = 0; k < FracTaps; ++k) {
+			row[k] = (float)(row[k] / sum);
+		}
+	}
+}
+
+// Points at the first RingAlignment aligned sample of a freshly zeroed
+// `storage` with room for `count` samples after it, or frees it for none.
+template <typename SampleType>
+auto allocateRing(Arena& arena,
+				  ArenaVector<SampleType>& storage,
+				  const int count) -> SampleType* {
+	if (count == 0) {
+		storage = arenaVector<SampleType>(arena, 0);
+		return nullptr;
+	}
+
+	constexpr auto pad = RingAlignment / (int)sizeof(SampleType);
+	storage = arenaVector<SampleType>(arena, count + pad);
+
+	const auto addr = reinterpret_cast<std::uintptr_t>(storage.data());
+	const auto misalignment = addr % RingAlignment;
+	return storage.data() +
+		   (misalignment == 0 ? 0 : (RingAlignment - misalignment)) /
+			   sizeof(SampleType);
+}
+
+template <typename SampleType>
+inline auto ringFor(State& ctx) -> SampleType* {
+	if constexpr (std::is_same_v<SampleType, double>) {
+		return ctx.ringDouble;
+	} else {
+		return ctx.ring;
+	}
+}
+
+// Sizes the rings for the largest offset the knobs can reach at this rate, so
+// turning a knob never needs a bigger ring. Only the rings for the precision
+// the host will process in are allocated.
+auto prepareDelay(State& ctx,
+				  const double sampleRate,
+				  const int numChannels,
+				  const int maxBlockSize,
+				  const bool doublePrecision) -> void {
+	ctx.numChannels = numChannels;
+	ctx.offsetScale = (float)(sampleRate / ReferenceSampleRate);
+	ctx.stepOffsetsTable = nullptr;
+	ctx.fracTable = arenaVector<float>(ctx.arena, FracPhases * FracTaps);
+	buildFracTable(ctx.fracTable);
+
+	// One segment per hit, plus the one the block starts in
+	ctx.segments = arenaVector<HitSegment>(ctx.arena, 0, maxBlockSize + 1);
+
+	ctx.ringSize = (int)std::bit_ceil(
+		(unsigned)(maxOffsetSamples(sampleRate) + FracTaps + 1));
+	ctx.ringMask = ctx.ringSize - 1;
+
+	const auto count = ctx.ringSize * numChannels;
+	ctx.ring =
+		allocateRing(ctx.arena, ctx.ringStorage, doublePrecision ? 0 : count);
+	ctx.ringDouble = allocateRing(ctx.arena, ctx.ringStorageDouble,
+								  doublePrecision ? count : 0);
+
+	ctx.delayIdx = 0;
+	ctx.pendingSamples = 0;
+}
+
+// Calls `fn` with the channel count as a compile time constant for the layouts
+// we see most (mono, stereo, 5.1, 7.1, 7.1.4), or 0 for anything else, in
+// which case the kernel reads the count at runtime.
+template <typename Fn>
+inline auto withChannelCount(const int numChannels, Fn&& fn) -> void {
+	switch (numChannels) {
+		case 1:
+			return fn(std::integral_constant<int, 1>{});
+		case 2:
+			return fn(std::integral_constant<int, 2>{});
+		case 6:
+			return fn(std::integral_constant<int, 6>{});
+		case 8:
+			return fn(std::integral_constant<int, 8>{});
+		case 12:
+			return fn(std::integral_constant<int, 12>{});
+		default:
+			return fn(std::integral_constant<int, 0>{});
+	}
+}
+
+// Turns a detector's events into segments, moving `currDelay` through the
+// lane's sequence at every event of type `advanceOn`. The sample of that event
+// already takes the next offset. If we've run out of room for segments the
+// rest of the block keeps the current one.
+//
+// In timeline mode a hit's step has to come from where the hit itself starts,
+// so it always moves on at onsets. A block that starts before we've seen a
+// hit, like the first of a render that starts partway into a song, takes the
+// step of where it starts instead of playing unshifted.
+auto buildLaneSegments(State& ctx,
+					   const FractalNoiseResult& offsets,
+					   const ArenaVector<DetectorEvent>& events,
+					   const DetectorEventType advanceOn,
+					   const int lane,
+					   int& currDelay) -> void {
+	const auto type = ctx.timeline ? DetectorEventType::Onset : advanceOn;
+	if (ctx.timeline && currDelay < 0) {
+		currDelay = nextStep(ctx, offsets.steps, currDelay, 0);
+	}
+
+	auto& segments = ctx.segments;
+	segments.clear();
+	segments.push_back(stepSegmentAt(ctx, 0, currDelay, lane));
+
+	for (const auto& event : events) {
+		if (event.type != type) {
+			continue;
+		}
+
+		currDelay =
+			advanceHit(ctx, offsets.steps, currDelay, event.pos, lane);
+
+		const auto segment = stepSegmentAt(ctx, event.pos, currDelay, lane);
+		if (segments.back().start == event.pos) {
+			segments.back() = segment;
+		} else if (segments.size() < segments.capacity()) {
+			segments.push_back(segment);
+		}
+	}
+}
+
+auto buildSegments(State& ctx,
+				   const FractalNoiseResult& offsets,
+				   const DetectorEventType advanceOn) -> void {
+	buildLaneSegments(ctx, offsets, ctx.detector.events, advanceOn, 0,
+					  ctx.currDelay);
+}
+
+// Adds `n` samples of `src` into the ring starting at `pos`, wrapping once.
+template <typename SampleType>
+inline auto ringAdd(SampleType* ring,
+					const int size,
+					const int pos,
+					const SampleType* src,
+					const int n) -> void {
+	const auto first = std::min(n, size - pos);
+	FloatVectorOperations::add(ring + pos, src, first);
+	if (first < n) {
+		FloatVectorOperations::add(ring, src + first, n - first);
+	}
+}
+
+// Same as ringAdd, but scales `src` by `gain` on the way in.
+template <typename SampleType>
+inline auto ringAddScaled(SampleType* ring,
+						  const int size,
+						  const int pos,
+						  const SampleType* src,
+						  const SampleType gain,
+						  const int n) -> void {
+	const auto first = std::min(n, size - pos);
+	FloatVectorOperations::addWithMultiply(ring + pos, src, gain, first);
+	if (first < n) {
+		FloatVectorOperations::addWithMultiply(ring, src + first, gain,
+											   n - first);
+	}
+}
+
+// Moves `n` samples out of the ring starting at `pos` into `dst`, leaving
+// zeros behind, wrapping once.
+template <typename SampleType>
+inline auto ringTake(SampleType* ring,
+					 const int size,
+					 const int pos,
+					 SampleType* dst,
+					 const int n) -> void {
+	const auto first = std::min(n, size - pos);
+	FloatVectorOperations::copy(dst, ring + pos, first);
+	FloatVectorOperations::clear(ring + pos, first);
+	if (first < n) {
+		FloatVectorOperations::copy(dst + first, ring, n - first);
+		FloatVectorOperations::clear(ring, n - first);
+	}
+}
+
+// Every sample in a segment lands the same distance ahead of the read head, so
+// the whole segment is added into the ring and then read back out as two
+// contiguous runs. Because all adds land before the read, this matches doing
+// it a sample at a time, as long as the writes don't wrap around onto samples
+// we are about to read; long segments are split so they can't. All channels
+// move together, so they share one read head, which the caller moves on once
+// every channel has been rendered.
+//
+// In fractional mode each tap of the segment's phase is added as its own
+// scaled run, so the interpolation costs FracTaps vector passes over the
+// samples being written and nothing over the rest of the ring. The segment's
+// gain is folded into the same write, into the taps or the one scaled add.
+//
+// A silent block adds nothing, so it only has to drain the ring. Either way
+// `pending` ends up covering the furthest sample written so far.
+template <int NumChannels, typename SampleType>
+auto renderSegmentsN(State& ctx,
+					 const HitSegment* segments,
+					 const int numSegments,
+					 SampleType* const* channels,
+					 const int firstChannel,
+					 const int numChannels,
+					 const int numSamples,
+					 const bool inputSilent,
+					 int& pendingSamples) -> void {
+	const auto count = NumChannels > 0 ? NumChannels : numChannels;
+	const auto size = ctx.ringSize;
+	const auto mask = ctx.ringMask;
+	const auto fractional = ctx.fractional;
+	auto delayIdx = ctx.delayIdx;
+	auto pending = pendingSamples;
+
+	for (auto s = 0; s < numSegments; ++s) {
+		const auto end =
+			s + 1 < numSegments ? segments[s + 1].start : numSamples;
+
+		// Writing behind the read head would only be heard a whole ring
+		// later, so negative offsets play on time instead
+		const auto reach = fractional ? FracTaps + 1 : 1;
+		const auto offset = std::clamp(segments[s].offset, 0, size - reach);
+		const auto* const taps =
+			ctx.fracTable.data() + segments[s].phase * FracTaps;
+		const auto gain = (SampleType)segments[s].gain;
+
+		for (auto start = segments[s].start; start < end;) {
+			const auto n = std::min(end - start, size - offset - reach + 1);
+			const auto writeIdx = (delayIdx + offset) & mask;
+
+			for (auto channel = 0; channel < count; ++channel) {
+				auto* const ring =
+					ringFor<SampleType>(ctx) + (firstChannel + channel) * size;
+				auto* const buffPtr = channels[channel] + start;
+
+				if (inputSilent) {
+					// Nothing to add, just drain the ring below
+				} else if (fractional) {
+					for (auto k = 0; k < FracTaps; ++k) {
+						if (taps[k] != 0.f) {
+							ringAddScaled(ring, size, (writeIdx + 1 + k) & mask,
+										  buffPtr, (SampleType)taps[k] * gain,
+										  n);
+						}
+					}
+				} else if (gain != SampleType{1}) {
+					ringAddScaled(ring, size, writeIdx, buffPtr, gain, n);
+				} else {
+					ringAdd(ring, size, writeIdx, buffPtr, n);
+				}
+				ringTake(ring, size, delayIdx, buffPtr, n);
+			}
+
+			if (!inputSilent) {
+				pending = std::max(pending, offset + reach - 1 + n);
+			}
+			pending = std::max(pending - n, 0);
+
+			delayIdx = (delayIdx + n) & mask;
+			start += n;
+		}
+	}
+
+	pendingSamples = pending;
+}
+
+template <typename SampleType>
+auto renderSegmentsT(State& ctx,
+					 const HitSegment* segments,
+					 const int numSegments,
+					 SampleType* const* channels,
+					 const int firstChannel,
+					 const int numChannels,
+					 const int numSamples,
+					 const bool inputSilent,
+					 int& pendingSamples) -> void {
+	withChannelCount(numChannels, [&](auto n) {
+		renderSegmentsN<decltype(n)::value>(
+			ctx, segments, numSegments, channels, firstChannel, numChannels,
+			numSamples, inputSilent, pendingSamples);
+	});
+}
+
+auto renderSegments(State& ctx,
+					const HitSegment* segments,
+					const int numSegments,
+					float* const* channels,
+					const int firstChannel,
+					const int numChannels,
+					const int numSamples,
+					const bool inputSilent,
+					int& pendingSamples) -> void {
+	renderSegmentsT(ctx, segments, numSegments, channels, firstChannel,
+					numChannels, numSamples, inputSilent, pendingSamples);
+}
+
+auto renderSegments(State& ctx,
+					const HitSegment* segments,
+					const int numSegments,
+					double* const* channels,
+					const int firstChannel,
+					const int numChannels,
+					const int numSamples,
+					const bool inputSilent,
+					int& pendingSamples) -> void {
+	renderSegmentsT(ctx, segments, numSegments, channels, firstChannel,
+					numChannels, numSamples, inputSilent, pendingSamples);
+}
+
+template <typename SampleType>
+auto renderDelayT(State& ctx,
+				  SampleType* const* channels,
+				  const int numChannels,
+				  const int numSamples,
+				  const bool inputSilent) -> void {
+	renderSegments(ctx, ctx.segments.data(), (int)ctx.segments.size(),
+				   channels, 0, numChannels, numSamples, inputSilent,
+				   ctx.pendingSamples);
+	skipDelay(ctx, numSamples);
+}
+
+auto renderDelay(State& ctx,
+				 float* const* channels,
+				 const int numChannels,
+				 const int numSamples,
+				 const bool inputSilent) -> void {
+	renderDelayT(ctx, channels, numChannels, numSamples, inputSilent);
+}
+
+auto renderDelay(State& ctx,
+				 double* const* channels,
+				 const int numChannels,
+				 const int numSamples,
+				 const bool inputSilent) -> void {
+	renderDelayT(ctx, channels, numChannels, numSamples, inputSilent);
+}
+
+// Moves the read head over a block when both the input and the ring are
+// silent. The output is the silent input, so there's nothing to write.
+auto skipDelay(State& ctx, const int numSamples) -> void {
+	ctx.delayIdx = (ctx.delayIdx + numSamples) & ctx.ringMask;
+}
+
+template <typename SampleType>
+auto isSilentT(const SampleType* const* channels,
+			   const int numChannels,
+			   const int numSamples) -> bool {
+	for (auto channel = 0; channel < numChannels; ++channel) {
+		const auto range =
+			FloatVectorOperations::findMinAndMax(channels[channel], numSamples);
+		if (range.getStart() != SampleType{} ||
+			range.getEnd() != SampleType{}) {
+			return false;
+		}
+	}
+	return true;
+}
+
+auto isSilent(const float* const* channels,
+			  const int numChannels,
+			  const int numSamples) -> bool {
+	return isSilentT(channels, numChannels, numSamples);
+}
+
+auto isSilent(const double* const* channels,
+			  const int numChannels,
+			  const int numSamples) -> bool {
+	return isSilentT(channels, numChannels, numSamples);
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include "detector.hpp"
+
+#include <vector>
+
+struct State;
+struct FractalNoiseResult;
+
+// A run of samples that all share the same offset and gain. A block is split
+// into segments wherever the sequence moves to its next step: when the
+// detector releases a hit, or when a hit starts if the hits come from MIDI.
+struct HitSegment {
+	int start = 0;
+	int offset = 0;
+	int phase = 0;
+	float gain = 1.f;
+};
+
+auto prepareDelay(State& ctx,
+				  double sampleRate,
+				  int numChannels,
+				  int maxBlockSize,
+				  bool doublePrecision = false) -> void;
+auto buildSegments(State& ctx,
+				   const FractalNoiseResult& offsets,
+				   DetectorEventType advanceOn) -> void;
+auto buildLaneSegments(State& ctx,
+					   const FractalNoiseResult& offsets,
+					   const ArenaVector<DetectorEvent>& events,
+					   DetectorEventType advanceOn,
+					   int lane,
+					   int& currDelay) -> void;
+auto renderDelay(State& ctx,
+				 float* const* channels,
+				 int numChannels,
+				 int numSamples,
+				 bool inputSilent) -> void;
+auto renderDelay(State& ctx,
+				 double* const* channels,
+				 int numChannels,
+				 int numSamples,
+				 bool inputSilent) -> void;
+auto skipDelay(State& ctx, int numSamples) -> void;
+
+// Renders `segments` into `numChannels` channels whose rings start at
+// `firstChannel`, without moving the read head. Once every channel sharing the
+// rings is rendered, skipDelay moves it on.
+auto renderSegments(State& ctx,
+					const HitSegment* segments,
+					int numSegments,
+					float* const* channels,
+					int firstChannel,
+					int numChannels,
+					int numSamples,
+					bool inputSilent,
+					int& pendingSamples) -> void;
+auto renderSegments(State& ctx,
+					const HitSegment* segments,
+					int numSegments,
+					double* const* channels,
+					int firstChannel,
+					int numChannels,
+					int numSamples,
+					bool inputSilent,
+					int& pendingSamples) -> void;
+auto isSilent(const float* const* channels, int numChannels, int numSamples)
+	-> bool;
+auto isSilent(const double* const* channels, int numChannels, int numSamples)
+	-> bool;
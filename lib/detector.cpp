@@ -0,0 +1,210 @@
+#include "detector.hpp"
+
+#include <juce_audio_basics/juce_audio_basics.h>
+
+#include <algorithm>
+#include <cmath>
+#include <type_traits>
+#include <utility>
+
+using juce::FloatVectorOperations;
+
+inline auto coeffFromMs(const float ms, const double sampleRate) -> float {
+	return (float)std::exp(-1.0 / (ms * 0.001 * sampleRate));
+}
+
+auto prepareDetector(Detector& det,
+					 Arena& arena,
+					 const double sampleRate,
+					 const int maxBlockSize,
+					 const bool doublePrecision) -> void {
+	const auto& settings = det.settings;
+
+	det.sampleRate = sampleRate;
+	det.attackCoeff = coeffFromMs(settings.attackMs, sampleRate);
+	det.releaseCoeff = coeffFromMs(settings.releaseMs, sampleRate);
+	det.holdSamples =
+		std::max(1, (int)std::round(settings.holdMs * 0.001 * sampleRate));
+
+	settleDetector(det);
+
+	const auto floatSize = doublePrecision ? 0 : maxBlockSize;
+	const auto doubleSize = doublePrecision ? maxBlockSize : 0;
+	det.key = arenaVector<float>(arena, floatSize);
+	det.scratch = arenaVector<float>(arena, floatSize);
+	det.keyDouble = arenaVector<double>(arena, doubleSize);
+	det.scratchDouble = arenaVector<double>(arena, doubleSize);
+	det.events = arenaVector<DetectorEvent>(arena, 0, maxBlockSize + 1);
+}
+
+template <typename SampleType>
+inline auto keyBuffers(Detector& det)
+	-> std::pair<ArenaVector<SampleType>&, ArenaVector<SampleType>&> {
+	if constexpr (std::is_same_v<SampleType, double>) {
+		return {det.keyDouble, det.scratchDouble};
+	} else {
+		return {det.key, det.scratch};
+	}
+}
+
+inline auto pushEvent(Detector& det,
+					  const int pos,
+					  const DetectorEventType type) -> void {
+	if (det.events.size() < det.events.capacity()) {
+		det.events.push_back({pos, type});
+	}
+}
+
+inline auto updateNoiseFloor(Detector& det,
+							 const float meanSquare,
+							 const int n) -> void {
+	const auto floorMs = meanSquare < det.noiseFloor
+							 ? det.settings.noiseFloorFallMs
+							 : det.settings.noiseFloorRiseMs;
+	const auto coeff =
+		1.f - (float)std::exp(-(double)n / (floorMs * 0.001 * det.sampleRate));
+	det.noiseFloor += coeff * (meanSquare - det.noiseFloor);
+}
+
+// `key` is the power of either the loudest channel or the mono sum at every
+// sample, so however many channels come in, a hit only shows up once. It is
+// built in the host's precision; only the envelope runs in float.
+template <typename SampleType>
+auto runDetectorChunk(Detector& det,
+					  const SampleType* const* channels,
+					  const int numChannels,
+					  const int start,
+					  const int n,
+					  const DetectorKey keyMode) -> void {
+	auto [keyBuffer, scratchBuffer] = keyBuffers<SampleType>(det);
+	auto* const key = keyBuffer.data();
+	auto* const scratch = scratchBuffer.data();
+
+	if (keyMode == DetectorKey::Sum) {
+		FloatVectorOperations::copy(key, channels[0] + start, n);
+		for (auto channel = 1; channel < numChannels; ++channel) {
+			FloatVectorOperations::add(key, channels[channel] + start, n);
+		}
+		FloatVectorOperations::multiply(
+			key, (SampleType)1 / (SampleType)numChannels, n);
+	} else {
+		FloatVectorOperations::abs(key, channels[0] + start, n);
+		for (auto channel = 1; channel < numChannels; ++channel) {
+			FloatVectorOperations::abs(scratch, channels[channel] + start, n);
+			FloatVectorOperations::max(key, key, scratch, n);
+		}
+	}
+	FloatVectorOperations::multiply(key, key, key, n);
+
+	auto sum = SampleType{};
+	for (auto i = 0; i < n; ++i) {
+		sum += key[i];
+	}
+	const auto meanSquare = (float)(sum / (SampleType)n);
+	if (det.settling) {
+		det.noiseFloor = meanSquare;
+		det.settling = false;
+	}
+
+	const auto& settings = det.settings;
+	const auto minLevel = settings.minThreshold * settings.minThreshold;
+	const auto openLevel = std::max(
+		minLevel, det.noiseFloor * settings.openRatio * settings.openRatio);
+	const auto closeLevel = std::max(
+		minLevel, det.noiseFloor * settings.closeRatio * settings.closeRatio);
+
+	const auto peak = (float)FloatVectorOperations::findMaximum(key, n);
+
+	if (!det.exact && !det.open && peak <= openLevel &&
+		det.envelope <= openLevel) {
+		// Nothing in this chunk can open the gate, so skip following the
+		// envelope sample by sample and just let it decay
+		det.envelope =
+			std::max(det.envelope * std::pow(det.releaseCoeff, (float)n),
+					 (float)key[n - 1]);
+	} else {
+		auto envelope = det.envelope;
+		for (auto i = 0; i < n; ++i) {
+			const auto x = (float)key[i];
+			const auto coeff =
+				x > envelope ? det.attackCoeff : det.releaseCoeff;
+			envelope = x + coeff * (envelope - x);
+
+			if (!det.open) {
+				if (envelope > openLevel) {
+					det.open = true;
+					det.quietFor = 0;
+					pushEvent(det, start + i, DetectorEventType::Onset);
+				}
+			} else {
+				det.quietFor = envelope < closeLevel ? det.quietFor + 1 : 0;
+				if (det.quietFor >= det.holdSamples) {
+					det.open = false;
+					pushEvent(det, start + i, DetectorEventType::Release);
+				}
+			}
+		}
+		det.envelope = envelope;
+	}
+
+	updateNoiseFloor(det, meanSquare, n);
+}
+
+template <typename SampleType>
+auto runDetectorT(Detector& det,
+				  const SampleType* const* channels,
+				  const int numChannels,
+				  const int numSamples,
+				  const DetectorKey keyMode) -> void {
+	det.events.clear();
+
+	const auto chunkSize = (int)keyBuffers<SampleType>(det).first.size();
+	if (numChannels <= 0 || chunkSize == 0) {
+		return;
+	}
+
+	for (auto start = 0; start < numSamples; start += chunkSize) {
+		runDetectorChunk(det, channels, numChannels, start,
+						 std::min(chunkSize, numSamples - start), keyMode);
+	}
+}
+
+auto runDetector(Detector& det,
+				 const float* const* channels,
+				 const int numChannels,
+				 const int numSamples,
+				 const DetectorKey keyMode) -> void {
+	runDetectorT(det, channels, numChannels, numSamples, keyMode);
+}
+
+auto runDetector(Detector& det,
+				 const double* const* channels,
+				 const int numChannels,
+				 const int numSamples,
+				 const DetectorKey keyMode) -> void {
+	runDetectorT(det, channels, numChannels, numSamples, keyMode);
+}
+
+// Same as running the detector over `numSamples` of digital silence with the
+// gate closed, without touching the buffer.
+auto skipDetector(Detector& det, const int numSamples) -> void {
+	det.events.clear();
+	det.envelope *= std::pow(det.releaseCoeff, (float)numSamples);
+	if (det.settling) {
+		det.noiseFloor = 0.f;
+		det.settling = false;
+	}
+	updateNoiseFloor(det, 0.f, numSamples);
+}
+
+// Forgets everything the detector has heard. The floor takes the level of the
+// first chunk after this rather than rising to it over noiseFloorRiseMs, and
+// it falls quickly if that chunk was a hit, so wherever the audio starts the
+// floor is back where it would have been within a few hundred milliseconds.
+auto settleDetector(Detector& det) -> void {
+	det.envelope = 0.f;
+	det.noiseFloor = 0.f;
+	det.quietFor = 0;
+	det.open = false;
+	det.settling = true;
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include "arena.hpp"
+
+struct DetectorSettings {
+	// Envelope follower
+	float attackMs = 0.5f;
+	float releaseMs = 10.f;
+
+	// The gate opens when the envelope rises `openRatio` times above the
+	// learned noise floor and closes once it has spent `holdMs` below
+	// `closeRatio` times the floor. Neither level goes below `minThreshold`.
+	float openRatio = 4.f;
+	float closeRatio = 2.f;
+	float holdMs = 1.f;
+	float minThreshold = 0.00001f;
+
+	// The noise floor is a running RMS that rises slowly and falls quickly,
+	// so it settles on the level between hits rather than the hits themselves
+	float noiseFloorRiseMs = 2000.f;
+	float noiseFloorFallMs = 50.f;
+};
+
+enum class DetectorEventType { Onset, Release };
+
+// How the channels handed to runDetector become one key signal. Loudest gates
+// the delayed channels together; Sum is for a sidechain, where a mono mix of
+// the key is what we want to listen to.
+enum class DetectorKey { Loudest, Sum };
+
+struct DetectorEvent {
+	int pos = 0;
+	DetectorEventType type = DetectorEventType::Onset;
+};
+
+// Finds where hits start and end in a block. The detector only produces
+// `events`; anything that wants to react to hits reads them from there.
+struct Detector {
+	DetectorSettings settings;
+
+	double sampleRate = 44100.0;
+	float attackCoeff = 0.f;
+	float releaseCoeff = 0.f;
+	int holdSamples = 0;
+
+	// Both are mean square, not RMS, so the per-sample path needs no sqrt
+	float envelope = 0.f;
+	float noiseFloor = 0.f;
+	int quietFor = 0;
+	bool open = false;
+
+	// Set by settleDetector. The next chunk sets the floor to its own level
+	// instead of rising to it from wherever it was.
+	bool settling = true;
+
+	// Follow the envelope at every sample, even through chunks that can't
+	// open the gate, rather than approximating its decay over the chunk
+	bool exact = false;
+
+	// The key is built in the host's sample type, so only the pair for the
+	// precision we were prepared for is allocated
+	ArenaVector<float> key;
+	ArenaVector<float> scratch;
+	ArenaVector<double> keyDouble;
+	ArenaVector<double> scratchDouble;
+	ArenaVector<DetectorEvent> events;
+};
+
+auto prepareDetector(Detector& det,
+					 Arena& arena,
+					 double sampleRate,
+					 int maxBlockSize,
+					 bool doublePrecision = false) -> void;
+auto runDetector(Detector& det,
+				 const float* const* channels,
+				 int numChannels,
+				 int numSamples,
+				 DetectorKey keyMode = DetectorKey::Loudest) -> void;
+auto runDetector(Detector& det,
+				 const double* const* channels,
+				 int numChannels,
+				 int numSamples,
+				 DetectorKey keyMode = DetectorKey::Loudest) -> void;
+auto skipDetector(Detector& det, int numSamples) -> void;
+auto settleDetector(Detector& det) -> void;
@@ -3,43 +3,22 @@
 //
 
 #include "engine.hpp"
+#include "bank.hpp"
+#include "fft.hpp"
+#include "random.hpp"
+#include "sequences.hpp"
+#include "stream.hpp"
 
 #include <glm/glm.hpp>
 
 #include <algorithm>
 #include <complex>
+#include <cstdint>
 #include <iostream>
-#include <valarray>
+#include <utility>
 #include <vector>
 
-using c_val_array = std::valarray<std::complex<float>>;
-
-auto fft(c_val_array& x) {
-	const size_t N = x.size();
-	if (N <= 1)
-		return;
-
-	auto even = c_val_array{x[std::slice(0, N / 2, 2)]};
-	auto odd = c_val_array{x[std::slice(1, N / 2, 2)]};
-
-	fft(even);
-	fft(odd);
-
-	for (auto k = 0; k < N / 2; ++k) {
-		auto t = std::polar<float>(1.0, -2.0 * M_PI * k / N) * odd[k];
-		x[k] = even[k] + t;
-		x[k + N / 2] = even[k] - t;
-	}
-}
-
-auto ifft(c_val_array& x) {
-	x = x.apply(std::conj);	 // conjugate input
-	fft(x);					 // forward FFT
-	x = x.apply(std::conj);	 // conjugate again
-	x /= x.size();			 // normalize
-}
-
-auto stdArr(const c_val_array& data,
+auto stdArr(const std::vector<float>& data,
 			const float mean,
 			const bool sample = false) {
 	const auto n = data.size();
@@ -47,8 +26,8 @@ auto stdArr(const c_val_array& data,
 		return 0.0;
 
 	auto variance = 0.0;
-	for (const auto& x : data)
-		variance += (x.real() - mean) * (x.real() - mean);
+	for (const auto x : data)
+		variance += (x - mean) * (x - mean);
 
 	variance /= (sample ? (n - 1) : n);
 
@@ -70,28 +49,35 @@ auto genFreqBins(int n) -> std::vector<float> {
 	return vec;
 }
 
-auto randVals = std::vector<float>{};
-
-auto recalcRandVals() -> void {
-	const auto seed = time(nullptr);
-	srand(seed);
-
-	randVals.clear();
-
-	// TODO: 100 is way higher than the max but lets go no magic number
-	for (auto i = 0; i < 100; ++i) {
-		randVals.emplace_back((float)rand() / RAND_MAX * M_PI * 2.);
-	}
+// cos and sin of `turns` whole turns, for turns in [0, 1). Reduced to an
+// eighth of a turn either side of a quadrant and rotated back, with no calls
+// or branches so a loop of them vectorises. Within 5e-7 of std::polar.
+inline auto unitPhasor(const float turns) -> std::pair<float, float> {
+	const auto quadrant = (int)(turns * 4.f + 0.5f);
+	const auto x = (turns - (float)quadrant * 0.25f) * (float)(2. * M_PI);
+	const auto x2 = x * x;
+	const auto sin =
+		x * (1.f + x2 * (-1.f / 6.f +
+						 x2 * (1.f / 120.f + x2 * (-1.f / 5040.f))));
+	const auto cos =
+		1.f + x2 * (-0.5f + x2 * (1.f / 24.f +
+								  x2 * (-1.f / 720.f + x2 * (1.f / 40320.f))));
+
+	// Quadrants 1 and 3 swap them, 1 and 2 negate cos, 2 and 3 negate sin
+	const auto swap = (float)(quadrant & 1) * (sin - cos);
+	const auto cosSign = 1.f - (float)((quadrant + 1) & 2);
+	const auto sinSign = 1.f - (float)(quadrant & 2);
+	return {(cos + swap) * cosSign, (sin - swap) * sinSign};
 }
 
-auto genFractalOffsets(const int n, const float alpha, const float std)
-	-> FractalNoiseResult {
+auto genFractalOffsets(const int n,
+					   const float alpha,
+					   const float std,
+					   const std::uint64_t seed,
+					   const int lane) -> FractalNoiseResult {
 	auto res = FractalNoiseResult{};
 
-	if (randVals.empty()) {
-		recalcRandVals();
-	}
-
+	res.steps = n;
 	res.frequencies = genFreqBins(n);
 	res.frequencies[0] = config::Epsilon;  // The first bin will be 0 so we want
 										   // to avoid a div by 0 error
@@ -101,87 +87,345 @@ auto genFractalOffsets(const int n, const float alpha, const float std)
 	res.spectrum = std::vector<float>{};
 	res.spectrum.reserve(numFreqs);
 
-	for (auto i = 0; i < numFreqs; ++i) {
+	// The transform's input, with each bin's magnitude in its real part for
+	// now
+	auto spectrum = std::vector<std::complex<float>>(numFreqs);
+	auto* const bins = reinterpret_cast<float*>(spectrum.data());
+
+	for (auto i = std::size_t{0}; i < numFreqs; ++i) {
 		res.spectrum.emplace_back(1. / std::pow(res.frequencies[i], alpha));
+		bins[i * 2] = std::sqrt(res.spectrum[i]);
+	}
+
+	// Bin i of a lane takes draw i of that lane's stream of the seed, so no
+	// bin depends on another and nothing is shared with other instances. The
+	// draws and the phasors are plain 32-bit arithmetic, so this vectorises
+	// and writes straight into the transform's input.
+	const auto key = (std::uint32_t)counterRandom(seed, (std::uint64_t)lane);
+	for (auto i = std::size_t{0}; i < numFreqs; ++i) {
+		const auto [cos, sin] =
+			unitPhasor(unitFloat32(counterRandom32(key, (std::uint32_t)i)));
+		const auto magnitude = bins[i * 2];
+		bins[i * 2] = magnitude * cos;
+		bins[i * 2 + 1] = magnitude * sin;
 	}
 
-	auto phases = std::vector<float>{};
-	phases.reserve(numFreqs);
+	// Only the non-negative frequencies are needed, the rest mirror them
+	const auto& plan = realFftPlan((int)(numFreqs * 2 - 2));
+	auto scratch = std::vector<std::complex<float>>(realFftScratchSize(plan));
+	res.offsets = std::vector<float>(plan.size);
+	inverseRealFft(plan, spectrum.data(), res.offsets.data(), scratch.data());
 
-	for (auto i = 0; i < numFreqs; ++i) {
-		phases.emplace_back(randVals[i]);
+	auto sum = 0.;
+	for (const auto val : res.offsets) {
+		sum += val;
 	}
+	const auto mean = sum / (float)res.offsets.size();
 
-	auto spectrum = std::vector<std::complex<float>>{};
-	spectrum.reserve(numFreqs);
+	// Measured after centring, so about zero rather than the mean
+	for (auto& val : res.offsets) {
+		val -= mean;
+	}
+	const auto scale = std / stdArr(res.offsets, 0.f);
+	for (auto& val : res.offsets) {
+		val *= scale;
+	}
+
+	const auto [minIt, maxIt] =
+		std::minmax_element(res.offsets.begin(), res.offsets.end());
+	const auto range = *maxIt - *minIt;
+	res.minOffset = *minIt;
 
-	for (auto i = 0; i < numFreqs; ++i) {
-		spectrum.emplace_back(
-			std::polar(std::sqrt(res.spectrum[i]), phases[i]));
+	for (const auto val : res.offsets) {
+		res.normOffsets.push_back((val - *minIt) / range);
 	}
 
-	auto fullSpectrum = std::vector<std::complex<float>>{};
-	fullSpectrum.reserve(numFreqs * 2 - 1);
+	return res;
+}
+
+auto offsetAt(const float offset,
+			  const float minOffset,
+			  const float variance,
+			  const float lookahead) -> float {
+	return (offset - minOffset * (1.f - lookahead)) *
+		   (variance * (MaxVarianceScale - 1.f) + 1.f);
+}
 
-	for (auto i = 0; i < numFreqs; ++i) {
-		fullSpectrum.emplace_back(spectrum[i]);
+inline auto offsetAt(const std::vector<float>& offsets,
+					 const float minOffset,
+					 const float variance,
+					 const float lookahead,
+					 const int idx) -> float {
+	if (offsets.empty() || idx < 0 || idx >= (int)offsets.size()) {
+		return 0;
 	}
 
-	for (auto i = 1; i < numFreqs - 1; ++i) {
-		fullSpectrum.emplace_back(std::conj(spectrum[numFreqs - i]));
+	return offsetAt(offsets[idx], minOffset, variance, lookahead);
+}
+
+auto gainAt(const float dynamics, const float gain) -> float {
+	return dynamics > 0.f
+			   ? std::pow(10.f, dynamics * MaxDynamicsDb * gain / 20.f)
+			   : 1.f;
+}
+
+// Scales an offset from getOffsetAt to the host rate and splits it into whole
+// samples and a fractional phase, if the fractional path is on. The whole part
+// is where the taps start, FracTaps / 2 ahead of where they centre the hit.
+auto placeHit(const State& ctx,
+			  const int start,
+			  const float offset,
+			  const float gain) -> HitSegment {
+	const auto scaled =
+		offset * ctx.offsetScale + (float)ctx.latencySamples;
+	if (!ctx.fractional) {
+		return {start, (int)std::round(scaled), 0, gain};
 	}
 
-	auto valArr = c_val_array{fullSpectrum.data(), fullSpectrum.size()};
+	auto whole = std::floor(scaled);
+	auto phase = (int)std::round((scaled - whole) * FracPhases);
+	if (phase == FracPhases) {
+		whole += 1.f;
+		phase = 0;
+	}
+	return {start, (int)whole - FracTaps / 2, phase, gain};
+}
 
-	ifft(valArr);
+auto hitDelay(const State& ctx, const HitSegment& hit) -> int {
+	if (!ctx.fractional) {
+		return hit.offset;
+	}
+	return hit.offset + FracTaps / 2 + (hit.phase * 2 >= FracPhases ? 1 : 0);
+}
 
-	auto sum = 0.;
-	for (auto i = 0; i < valArr.size(); ++i) {
-		sum += valArr[i].real();
+auto getOffsetAt(const State& ctx,
+				 const FractalNoiseResult& offsets,
+				 const int idx) -> float {
+	return offsetAt(offsets.offsets, offsets.minOffset, ctx.variance,
+					ctx.lookahead, idx);
+}
+
+// Called once per block on the audio thread. The knobs are read once here, and
+// the per-step table only changes when one of its inputs did.
+auto updateStepOffsets(State& ctx, const FractalNoiseResult& offsets) -> void {
+	const auto variance = ctx.variance.load();
+	const auto lookahead = ctx.lookahead.load();
+	const auto dynamics = ctx.dynamics;
+
+	if (&offsets == ctx.stepOffsetsTable &&
+		variance == ctx.stepOffsetsVariance &&
+		lookahead == ctx.stepOffsetsLookahead &&
+		dynamics == ctx.stepOffsetsDynamics &&
+		ctx.fractional == ctx.stepOffsetsFractional &&
+		ctx.compensated == ctx.stepOffsetsCompensated &&
+		ctx.multiLane == ctx.stepOffsetsMultiLane &&
+		ctx.streaming == ctx.stepOffsetsStreaming) {
+		return;
 	}
-	const auto mean = sum / (float)valArr.size();
 
-	valArr -= mean;
-	valArr *= std / stdArr(valArr, mean);
+	const auto numLanes =
+		ctx.multiLane ? std::min((int)offsets.laneOffsets.size(), MaxLanes)
+					  : 0;
+	auto minOffset =
+		ctx.streaming ? -StreamRange * OffsetStd : offsets.minOffset;
+	for (auto lane = 1; lane < numLanes && !ctx.streaming; ++lane) {
+		minOffset = std::min(minOffset, offsets.laneMinOffsets[lane]);
+	}
 
-	res.offsets = std::vector<float>{};
-	for (auto i = 0; i < valArr.size(); ++i) {
-		res.offsets.emplace_back(valArr[i].real());
+	// With the host compensating, every hit is pushed back by the earliest
+	// this sequence (or any lane's, or the streams' bound) could ever ask for
+	// (full lookahead, full variance), so early hits really do come out early
+	// and the latency only changes when the sequence does. The fractional
+	// taps start FracTaps / 2 ahead of the hit, which is counted in either
+	// path so switching tiers moves nothing.
+	ctx.latencySamples =
+		ctx.compensated
+			? (int)std::ceil(-minOffset * MaxVarianceScale * ctx.offsetScale) +
+				  FracTaps / 2
+			: 0;
+
+	for (auto lane = 0; lane < std::max(numLanes, 1); ++lane) {
+		const auto& laneOffsets =
+			lane == 0 ? offsets.offsets : offsets.laneOffsets[lane];
+		const auto laneMinOffset =
+			lane == 0 ? offsets.minOffset : offsets.laneMinOffsets[lane];
+		const auto& laneGains = offsets.laneGains[lane];
+
+		for (auto i = 0; i < MaxSteps; ++i) {
+			const auto step = lane * MaxSteps + i;
+			const auto hit = placeHit(
+				ctx, 0,
+				offsetAt(laneOffsets, laneMinOffset, variance, lookahead, i),
+				i < (int)laneGains.size() ? gainAt(dynamics, laneGains[i])
+										  : 1.f);
+			ctx.stepOffsets[step] = hit.offset;
+			ctx.stepPhases[step] = hit.phase;
+			ctx.stepGains[step] = hit.gain;
+		}
 	}
 
-	const auto [minIt, maxIt] =
-		std::minmax_element(res.offsets.begin(), res.offsets.end());
-	const auto range = *maxIt - *minIt;
-	res.minOffset = *minIt;
+	ctx.stepOffsetsTable = &offsets;
+	ctx.stepOffsetsVariance = variance;
+	ctx.stepOffsetsLookahead = lookahead;
+	ctx.stepOffsetsDynamics = dynamics;
+	ctx.stepOffsetsFractional = ctx.fractional;
+	ctx.stepOffsetsCompensated = ctx.compensated;
+	ctx.stepOffsetsMultiLane = ctx.multiLane;
+	ctx.stepOffsetsStreaming = ctx.streaming;
+}
 
-	for (const auto val : res.offsets) {
-		res.normOffsets.push_back((val - *minIt) / range);
+auto stepSegmentAt(const State& ctx,
+				   const int start,
+				   const int idx,
+				   const int lane) -> HitSegment {
+	if (ctx.streaming) {
+		return streamSegmentAt(ctx, start, lane);
+	}
+	// Before the first hit, which timeline mode never asks for
+	if (idx < 0) {
+		return {start, ctx.latencySamples, 0, 1.f};
+	}
+	const auto step = lane * MaxSteps + idx;
+	return {start, ctx.stepOffsets[step], ctx.stepPhases[step],
+			ctx.stepGains[step]};
+}
+
+// The step a hit `pos` samples into the block moves the sequence to. In
+// timeline mode that is the nearest TimelineStepsPerBeat grid line, wrapped
+// to the sequence, so a hit slightly ahead of or behind the beat still gets
+// that beat's offset.
+auto nextStep(const State& ctx,
+			  const int steps,
+			  const int currDelay,
+			  const int pos) -> int {
+	if (!ctx.timeline) {
+		return (currDelay + 1) % steps;
 	}
 
-	return res;
+	const auto ppq = ctx.timelinePpq + pos * ctx.timelinePpqPerSample;
+	const auto tick = std::llround(ppq * TimelineStepsPerBeat);
+	return (int)(((tick % steps) + steps) % steps);
+}
+
+// Moves `lane` on to its next hit: the step nextStep picks, and in streaming
+// mode the lane's streams' next values
+auto advanceHit(State& ctx,
+				const int steps,
+				const int currDelay,
+				const int pos,
+				const int lane) -> int {
+	if (ctx.streaming) {
+		advanceStream(ctx, lane);
+	}
+	return nextStep(ctx, steps, currDelay, pos);
 }
 
-auto getOffsetAt(const State& ctx, const int idx) -> float {
-	return (ctx.offsets.offsets.empty() || idx < 0 ||
-			idx >= ctx.offsets.offsets.size())
-			   ? 0
-			   : (ctx.offsets.offsets.at(idx) -
-				  ctx.offsets.minOffset * (1.f - ctx.lookahead)) *
-					 (ctx.variance * 100.f + 1.f);
+// Everything applyState publishes for one key, straight from the FFT
+auto generateSequence(const SequenceKey& key) -> FractalNoiseResult {
+	const auto steps = key.steps;
+	const auto alpha = alphaFromKey(key.alpha) * 0.3f + 0.5f;
+	const auto dynamicsAlpha = alphaFromKey(key.dynamicsAlpha) * 0.3f + 0.5f;
+
+	auto offsets = genFractalOffsets(steps, alpha, OffsetStd, key.seed);
+	offsets.laneOffsets.reserve(MaxLanes);
+	offsets.laneMinOffsets.reserve(MaxLanes);
+	offsets.laneOffsets.push_back(offsets.offsets);
+	offsets.laneMinOffsets.push_back(offsets.minOffset);
+	for (auto lane = 1; lane < MaxLanes; ++lane) {
+		auto laneOffsets =
+			genFractalOffsets(steps, alpha, OffsetStd, key.seed, lane);
+		offsets.laneOffsets.push_back(std::move(laneOffsets.offsets));
+		offsets.laneMinOffsets.push_back(laneOffsets.minOffset);
+	}
+
+	// The gains take the phases after every lane's offsets, so how loud a hit
+	// is doesn't follow how late it is
+	offsets.laneGains.reserve(MaxLanes);
+	for (auto lane = 0; lane < MaxLanes; ++lane) {
+		offsets.laneGains.push_back(genFractalOffsets(steps, dynamicsAlpha,
+													  1.f, key.seed,
+													  MaxLanes + lane)
+										.offsets);
+	}
+
+	return offsets;
 }
 
-auto getOffsetAtI(const State& ctx, const int idx) -> int {
-	return (int)std::round(getOffsetAt(ctx, idx));
+inline auto stateKey(const State& state) -> SequenceKey {
+	return {stepsFromKnobValue(state.steps), quantizeAlpha(state.alpha),
+			quantizeAlpha(state.dynamicsAlpha), state.seed.load()};
 }
 
+// Publishes the offset table for the knobs, shared with every other instance
+// on the same settings. Each key is generated at most once in the process,
+// whichever instance asks first, and always straight from the FFT. Runs on a
+// generator worker, or on the message thread when loading state, but never on
+// the audio thread. If the other finishes a later build first, this one is
+// dropped.
 auto applyState(State& state) -> void {
-	state.stepsI = stepsFromKnobValue(state.steps);
-	state.offsets =
-		genFractalOffsets(state.stepsI, state.alpha.load() * 0.3f + 0.5f, 10);
+	const auto generation = beginGeneration(state.generator);
+	const auto key = stateKey(state);
+	if (publishOffsets(state.generator,
+					   acquireSequence(sequenceCache(), key, generateSequence),
+					   generation)) {
+		state.stepsI = key.steps;
+		state.eventOffsetsUpdated.store(true);
+	}
+}
+
+// Interpolated tables are close to the exact ones but not the same, so they
+// are only drawn, never played or cached under the exact key
+auto previewState(State& state) -> bool {
+	const auto bank =
+		acquireBank(bankBuilder(), state.seed.load(), generateSequence);
+	if (!bank) {
+		return false;
+	}
+
+	const auto key = stateKey(state);
+	publishPreview(state.generator, std::make_shared<const FractalNoiseResult>(
+										sequenceFromBank(*bank, key)));
+	state.stepsI = key.steps;
 	state.eventOffsetsUpdated.store(true);
-	state.queuedOffsetRecalc.store(false);
+	return true;
+}
+
+auto bankReady(const State& state) -> bool {
+	return acquireBank(bankBuilder(), state.seed.load(), generateSequence) !=
+		   nullptr;
+}
+
+auto setOffline(State& ctx, const bool offline) -> void {
+	ctx.offline = offline;
+	ctx.detector.exact = offline;
+	for (auto& det : ctx.lanes.detectors) {
+		det.exact = offline;
+	}
+}
+
+// Every detector starts from scratch at the top of a render or after a jump,
+// so what it finds from there on doesn't depend on what was played before
+auto startTimeline(State& ctx) -> void {
+	settleDetector(ctx.detector);
+	for (auto& det : ctx.lanes.detectors) {
+		settleDetector(det);
+	}
 }
 
 auto stepsFromKnobValue(const float value) -> int {
-	return (int)(value * 20.f + 10.f);
+	return (int)(value * (float)(MaxSteps - MinSteps) + (float)MinSteps);
+}
+
+// The largest offset any knob setting can produce in either latency mode. A
+// zero mean sequence of n values with standard deviation s never spans more
+// than s * sqrt(2n), and its minimum is never below -s * sqrt(n - 1).
+// getOffsetAt measures from the minimum before scaling by the variance, and
+// compensated mode adds the largest negative offset and the fractional taps'
+// lead on top. At ReferenceSampleRate that fits a 4096 sample ring.
+auto maxOffsetSamples(const double sampleRate) -> int {
+	const auto maxRange = OffsetStd * std::sqrt(2.f * (float)MaxSteps);
+	const auto maxLatency = OffsetStd * std::sqrt((float)MaxSteps - 1.f);
+	return (int)std::ceil((maxRange + maxLatency) * MaxVarianceScale *
+						  sampleRate / ReferenceSampleRate) +
+		   FracTaps / 2 + 2;
 }
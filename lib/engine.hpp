@@ -4,16 +4,55 @@
 
 #pragma once
 
+#include "arena.hpp"
+#include "delay.hpp"
+#include "detector.hpp"
+#include "generator.hpp"
+#include "lanes.hpp"
+#include "midi.hpp"
+#include "params.hpp"
+#include "stream.hpp"
+
 #include <glm/glm.hpp>
 
+#include <array>
 #include <atomic>
+#include <cstddef>
+#include <cstdint>
 #include <vector>
 
-constexpr auto delayBufferSize = 10000;
+// Stands in for std::hardware_destructive_interference_size, which libc++ has
+// only recently shipped and whose value moves with -mtune where it exists.
+// Apple silicon pairs its 64 byte lines, so assume 128 there.
+#if defined(__APPLE__) && defined(__aarch64__)
+constexpr auto CacheLineSize = std::size_t{128};
+#else
+constexpr auto CacheLineSize = std::size_t{64};
+#endif
+
+constexpr auto MinSteps = 10;
+constexpr auto MaxSteps = 30;
+constexpr auto MaxLanes = 12;
+constexpr auto LaneWidth = 2;
+constexpr auto TimelineStepsPerBeat = 4;
+constexpr auto AutomationStepSamples = 32;
+constexpr auto ReferenceSampleRate = 44100.0;
+
+// Standard deviation of every sequence in samples at ReferenceSampleRate,
+// before the variance knob. Sequences used to come out well under what they
+// were asked for, 2.7 samples on average for 10, so this keeps the knob where
+// it was now that they don't.
+constexpr auto OffsetStd = 3.f;
+constexpr auto MaxVarianceScale = 101.f;
+constexpr auto MaxDynamicsDb = 6.f;
+constexpr auto RingAlignment = 64;
+constexpr auto FracTaps = 8;
+constexpr auto FracPhases = 32;
 constexpr auto Epsilon = 0.001f;
-constexpr auto Version = 2;
+constexpr auto Version = 3;
 constexpr auto Version_1 = 1;
 constexpr auto Version_2 = 2;
+constexpr auto Version_3 = 3;
 
 struct FractalNoiseResult {
 	std::vector<float> frequencies;
@@ -21,35 +60,184 @@ struct FractalNoiseResult {
 	std::vector<float> offsets;
 	std::vector<float> normOffsets;
 	float minOffset;
+	int steps = 0;
+
+	// One sequence per lane for multi-lane mode, each drawn with its own
+	// phases. Lane 0 is `offsets`.
+	std::vector<std::vector<float>> laneOffsets;
+	std::vector<float> laneMinOffsets;
+
+	// How loud each step of each lane plays, drawn with the dynamics alpha
+	// and phases of their own, at zero mean and unit deviation
+	std::vector<std::vector<float>> laneGains;
 };
 
+// Split into regions with a full cache line of padding between each, so the
+// message thread storing knobs and flags never invalidates the lines the audio
+// thread works on between them. Padding rather than alignas keeps State (and
+// the Processor holding it) at default alignment, which plain operator new
+// can allocate on every deployment target.
 struct State {
+	char padBeforeKnobs[CacheLineSize];
+
+	// The engine's copy of the knobs. Alpha, steps and the dynamics alpha
+	// follow the parameters on the message thread, variance and lookahead on
+	// the audio thread.
 	std::atomic<float> alpha = 0.5f;
 	std::atomic<float> steps = 0.5f;
 	std::atomic<float> variance = 0.5f;
 	std::atomic<float> lookahead = 0.0f;
+	std::atomic<float> dynamicsAlpha = 0.5f;
 
-	std::array<int, 2> delayIdx = {0, 0};
-	std::array<int, 2> gateIdx{};
-	std::array<bool, 2> isSoundOccurring{false, false};
-	std::array<bool, 2> isPlayingSample{false, false};
-	std::array<float, 2> _lastSample{};
+	// Every phase and stream of this instance is drawn from this, and it is
+	// saved with the rest of the state, so a session plays back the same
+	// sequence it was saved with
+	std::atomic<std::uint64_t> seed = 0;
 
-	std::array<std::array<float, delayBufferSize>, 2> delayBuffer{};
+	char padBeforeFlags[CacheLineSize];
 
+	// Flags shared between the editor and the generator workers, and the
+	// editor's knob edits on their way to the parameters
 	std::atomic<int> stepsI;
-	std::atomic<bool> queuedSeedRecalc = false;
-	std::atomic<bool> queuedOffsetRecalc = false;
 	std::atomic<bool> eventOffsetsUpdated = false;
+	ParamEditQueue paramEdits;
+
+	char padBeforeLatency[CacheLineSize];
 
-	FractalNoiseResult offsets;
+	// latencySamples as the audio thread last published it. Telling the host
+	// takes locks, so the message thread does that. Only the audio thread
+	// stores it, and only when it moves, on a line of its own so the timer
+	// reading it never touches the editor's flags.
+	std::atomic<int> latency = 0;
 
+	char padBeforeAudio[CacheLineSize];
+
+	// Everything from here to the generator belongs to the audio thread
+	int delayIdx = 0;
 	int currDelay = -1;
+
+	// How far past the read head the rings may still hold audio. Zero means
+	// every ring is empty.
+	int pendingSamples = 0;
+
+	// Backs every buffer below, so it is declared before them and outlives
+	// them
+	Arena arena;
+
+	Detector detector;
+
+	// Offsets are designed at ReferenceSampleRate and scaled to the host rate
+	// so a hit moves by the same amount of time whatever the rate
+	float offsetScale = 1.f;
+
+	// When set, hits are placed to 1/FracPhases of a sample through the
+	// windowed-sinc taps in fracTable (FracPhases rows of FracTaps). The taps
+	// centre a hit FracTaps / 2 samples past its offset, so placeHit takes
+	// that back off and both paths put a hit on the same sample.
+	bool fractional = false;
+	ArenaVector<float> fracTable;
+
+	// Set while the host renders offline. Offline renders follow the
+	// detector's envelope at every sample; live playback approximates it over
+	// chunks that can't open the gate. The fractional path stays on its own
+	// switch, since its short taps roll off the top octave and would make a
+	// bounce sound different from playback.
+	bool offline = false;
+
+	// Timeline mode picks each hit's step from where it lands on the host's
+	// timeline rather than from how many hits came before it, so any stretch
+	// of a song gets the same offsets however it is played or rendered.
+	// `timelinePpq` is the position of the block's first sample in quarter
+	// notes; `timeline` is only set while the host is reporting one. A block
+	// that doesn't start at `timelineNextPpq` starts the timeline over, and
+	// startTimeline settles the detectors so they hear it as if fresh.
+	bool timeline = false;
+	double timelinePpq = 0.0;
+	double timelinePpqPerSample = 0.0;
+	double timelineNextPpq = -1.0;
+
+	// Compensated mode reports latencySamples to the host and adds it to
+	// every offset so negative offsets can play early. Live mode has no
+	// latency and plays negative offsets on time instead, and the fractional
+	// path plays offsets under FracTaps / 2 samples as if they were that.
+	bool compensated = false;
+	int latencySamples = 0;
+
+	// How far each hit's level follows its lane's gain sequence, from 0 (every
+	// hit as it came in) to 1 (MaxDynamicsDb per deviation). The gain is
+	// applied as the hit is written into the rings, so it costs no extra pass.
+	float dynamics = 0.f;
+
+	// Streaming mode draws every hit's offset and gain from endless 1/f
+	// streams, one pair per lane, instead of cycling through the table, so the
+	// sequence never repeats. Timeline mode needs steps it can find by
+	// position, so it turns streaming off.
+	bool streaming = false;
+	std::array<StreamLane, MaxLanes> streams{};
+	StreamShape offsetShape;
+	StreamShape gainShape;
+	float streamAlpha = -1.f;
+	float streamDynamicsAlpha = -1.f;
+	std::uint64_t streamSeed = 0;
+
+	// Multi-lane mode treats every LaneWidth channels of the main bus as
+	// their own drum, with their own detector and place in their own sequence
+	bool multiLane = false;
+	Lanes lanes;
+
+	// One power-of-two ring per channel of the main bus, laid out back to
+	// back in ringStorage with `ring` aligned to RingAlignment bytes. Every
+	// channel is read and written in lockstep, so they share delayIdx. When
+	// the host processes in double precision the rings are ringDouble instead.
+	ArenaVector<float> ringStorage;
+	float* ring = nullptr;
+	ArenaVector<double> ringStorageDouble;
+	double* ringDouble = nullptr;
+	int numChannels = 0;
+	int ringSize = 0;
+	int ringMask = 0;
+
+	ArenaVector<HitSegment> segments;
+
+	MidiQueue midi;
+
+	// Final sample offset (and fractional phase and gain) of every step of
+	// every lane, lane by lane, rebuilt by updateStepOffsets only when the
+	// table, variance, lookahead, dynamics or one of the modes have moved since
+	// the last block
+	std::array<std::int32_t, MaxLanes * MaxSteps> stepOffsets{};
+	std::array<std::int32_t, MaxLanes * MaxSteps> stepPhases{};
+	std::array<float, MaxLanes * MaxSteps> stepGains{};
+	const FractalNoiseResult* stepOffsetsTable = nullptr;
+	float stepOffsetsVariance = -1.f;
+	float stepOffsetsLookahead = -1.f;
+	float stepOffsetsDynamics = -1.f;
+	bool stepOffsetsFractional = false;
+	bool stepOffsetsCompensated = false;
+	bool stepOffsetsMultiLane = false;
+	bool stepOffsetsStreaming = false;
+
+	char padBeforeGenerator[CacheLineSize];
+
+	// Declared last so stopping it waits out a build still running for us
+	// before the rest of the state goes
+	OffsetGenerator generator;
 };
 
 auto applyState(State& state) -> void;
 
+// Whether the parameter bank for the instance's seed is built. Queues it to be
+// built if it isn't.
+auto bankReady(const State& state) -> bool;
+
+// Shows the editor a table for the knobs from the parameter bank, without
+// waiting for the generator, if the bank is built
+auto previewState(State& state) -> bool;
+auto setOffline(State& ctx, bool offline) -> void;
+auto startTimeline(State& ctx) -> void;
+
 auto stepsFromKnobValue(float value) -> int;
+auto maxOffsetSamples(double sampleRate) -> int;
 
 namespace config {
 constexpr auto NumNoiseSamples = 100;
@@ -61,7 +249,25 @@ constexpr auto WindowSize = glm::vec2{1000, 500};
 constexpr auto HalfWindowSize = WindowSize / 2.f;
 }  // namespace config
 
-auto genFractalOffsets(int n, float alpha, float std) -> FractalNoiseResult;
-auto getOffsetAt(const State& ctx, int idx) -> float;
-auto getOffsetAtI(const State& ctx, int idx) -> int;
-auto recalcRandVals() -> void;
\ No newline at end of file
+auto genFractalOffsets(int n,
+					   float alpha,
+					   float std,
+					   std::uint64_t seed,
+					   int lane = 0) -> FractalNoiseResult;
+auto getOffsetAt(const State& ctx, const FractalNoiseResult& offsets, int idx)
+	-> float;
+auto offsetAt(float offset, float minOffset, float variance, float lookahead)
+	-> float;
+auto gainAt(float dynamics, float gain) -> float;
+auto placeHit(const State& ctx, int start, float offset, float gain)
+	-> HitSegment;
+
+// The whole samples `hit` is delayed by, phase rounded, for anything that
+// can't place it between samples
+auto hitDelay(const State& ctx, const HitSegment& hit) -> int;
+auto updateStepOffsets(State& ctx, const FractalNoiseResult& offsets) -> void;
+auto stepSegmentAt(const State& ctx, int start, int idx, int lane = 0)
+	-> HitSegment;
+auto nextStep(const State& ctx, int steps, int currDelay, int pos) -> int;
+auto advanceHit(State& ctx, int steps, int currDelay, int pos, int lane = 0)
+	-> int;
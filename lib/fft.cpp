@@ -0,0 +1,208 @@
+#include "fft.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <memory>
+#include <mutex>
+
+// Radix 2 first, since it has the cheapest butterfly, then each prime in
+// turn. Whatever is left after that is prime and done as one generic DFT.
+auto factorize(int size) -> std::vector<int> {
+	auto radices = std::vector<int>{};
+	for (auto p = 2; p * p <= size; ++p) {
+		while (size % p == 0) {
+			radices.push_back(p);
+			size /= p;
+		}
+	}
+	if (size > 1 || radices.empty()) {
+		radices.push_back(size);
+	}
+	return radices;
+}
+
+// The first stage combines runs of one value, so each run of the input has to
+// be where the decimation in time would put it. Index `n`, written in the
+// mixed radix of `radices`, moves to the index with its digits reversed.
+// Applying that as a list of swaps lets the transform run in place.
+auto digitReversalSwaps(const std::vector<int>& radices, const int size)
+	-> std::vector<std::pair<int, int>> {
+	auto from = std::vector<int>(size);
+	for (auto n = 0; n < size; ++n) {
+		auto rest = n;
+		auto span = size;
+		auto j = 0;
+		for (const auto p : radices) {
+			span /= p;
+			j += (rest % p) * span;
+			rest /= p;
+		}
+		from[j] = n;
+	}
+
+	auto swaps = std::vector<std::pair<int, int>>{};
+	auto visited = std::vector<bool>(size);
+	for (auto start = 0; start < size; ++start) {
+		for (auto j = start; !visited[j]; j = from[j]) {
+			visited[j] = true;
+			if (from[j] != start) {
+				swaps.emplace_back(j, from[j]);
+			}
+		}
+	}
+	return swaps;
+}
+
+auto makeFftPlan(const int size) -> FftPlan {
+	auto plan = FftPlan{};
+	plan.size = size;
+	plan.radices = factorize(size);
+	plan.swaps = digitReversalSwaps(plan.radices, size);
+	for (const auto p : plan.radices) {
+		plan.maxRadix = std::max(plan.maxRadix, p);
+	}
+
+	plan.twiddles.reserve(size);
+	for (auto k = 0; k < size; ++k) {
+		plan.twiddles.push_back(
+			std::polar(1.f, (float)(-2.0 * M_PI * k / size)));
+	}
+	return plan;
+}
+
+auto makeRealFftPlan(const int size) -> RealFftPlan {
+	auto plan = RealFftPlan{};
+	plan.size = size;
+	plan.half = &fftPlan(size / 2);
+
+	plan.twiddles.reserve(size / 2);
+	for (auto k = 0; k < size / 2; ++k) {
+		plan.twiddles.push_back(
+			std::polar(1.f, (float)(2.0 * M_PI * k / size)));
+	}
+	return plan;
+}
+
+// Plans are only ever added, and live behind a unique_ptr so the references we
+// hand out stay put as the map grows. The cache is never destroyed, so a
+// background build still running as the process exits can keep using it.
+template <typename Plan, typename Make>
+auto cachedPlan(const int size, Make&& make) -> const Plan& {
+	static auto& mutex = *new std::mutex{};
+	static auto& plans = *new std::map<int, std::unique_ptr<const Plan>>{};
+
+	const auto lock = std::lock_guard{mutex};
+	auto& plan = plans[size];
+	if (!plan) {
+		plan = std::make_unique<const Plan>(make(size));
+	}
+	return *plan;
+}
+
+auto fftPlan(const int size) -> const FftPlan& {
+	return cachedPlan<FftPlan>(size, makeFftPlan);
+}
+
+auto realFftPlan(const int size) -> const RealFftPlan& {
+	return cachedPlan<RealFftPlan>(size, makeRealFftPlan);
+}
+
+auto fftScratchSize(const FftPlan& plan) -> int {
+	return 2 * plan.maxRadix;
+}
+
+auto realFftScratchSize(const RealFftPlan& plan) -> int {
+	return plan.size / 2 + fftScratchSize(*plan.half);
+}
+
+// Iterative decimation in time. Each stage merges `radix` transforms of `span`
+// points that sit next to each other into one of `radix * span`, so after the
+// last stage the whole array is one transform.
+auto fft(const FftPlan& plan,
+		 std::complex<float>* data,
+		 std::complex<float>* scratch) -> void {
+	const auto size = plan.size;
+	const auto* const w = plan.twiddles.data();
+
+	for (const auto& [a, b] : plan.swaps) {
+		std::swap(data[a], data[b]);
+	}
+
+	auto span = 1;
+	for (auto stage = (int)plan.radices.size() - 1; stage >= 0; --stage) {
+		const auto radix = plan.radices[stage];
+		const auto length = span * radix;
+		const auto stride = size / length;
+
+		for (auto block = 0; block < size; block += length) {
+			auto* const x = data + block;
+
+			if (radix == 2) {
+				for (auto k = 0; k < span; ++k) {
+					const auto even = x[k];
+					const auto odd = x[k + span] * w[k * stride];
+					x[k] = even + odd;
+					x[k + span] = even - odd;
+				}
+				continue;
+			}
+
+			auto* const in = scratch;
+			auto* const out = scratch + radix;
+			const auto radixStride = size / radix;
+			for (auto k = 0; k < span; ++k) {
+				for (auto q = 0; q < radix; ++q) {
+					in[q] = x[q * span + k] * w[q * k * stride];
+				}
+				for (auto s = 0; s < radix; ++s) {
+					auto sum = in[0];
+					for (auto q = 1; q < radix; ++q) {
+						sum += in[q] * w[((q * s) % radix) * radixStride];
+					}
+					out[s] = sum;
+				}
+				for (auto s = 0; s < radix; ++s) {
+					x[s * span + k] = out[s];
+				}
+			}
+		}
+
+		span = length;
+	}
+}
+
+// Packs the even samples into the real parts and the odd samples into the
+// imaginary parts of a sequence half as long. Its spectrum is untangled from
+// the bins we're given, then one inverse of half the size produces both.
+auto inverseRealFft(const RealFftPlan& plan,
+					const std::complex<float>* bins,
+					float* out,
+					std::complex<float>* scratch) -> void {
+	const auto half = plan.size / 2;
+	auto* const z = scratch;
+
+	for (auto k = 0; k < half; ++k) {
+		auto even = std::complex<float>{};
+		auto odd = std::complex<float>{};
+		if (k == 0) {
+			even = (bins[0].real() + bins[half].real()) * 0.5f;
+			odd = (bins[0].real() - bins[half].real()) * 0.5f;
+		} else {
+			even = (bins[k] + std::conj(bins[half - k])) * 0.5f;
+			odd = (bins[k] - std::conj(bins[half - k])) * 0.5f *
+				  plan.twiddles[k];
+		}
+
+		// Conjugated so the forward transform below runs as an inverse
+		z[k] = std::conj(even + std::complex<float>{0.f, 1.f} * odd);
+	}
+
+	fft(*plan.half, z, scratch + half);
+
+	const auto scale = 1.f / (float)half;
+	for (auto n = 0; n < half; ++n) {
+		out[2 * n] = z[n].real() * scale;
+		out[2 * n + 1] = -z[n].imag() * scale;
+	}
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <complex>
+#include <utility>
+#include <vector>
+
+// Everything a forward transform of `size` points needs worked out ahead of
+// time: the radices it is split into, the swaps that put the input into the
+// order the butterflies want, and W^k for every k below `size`. Plans never
+// change once built, so one plan can run on any number of threads at once.
+struct FftPlan {
+	int size = 0;
+	int maxRadix = 1;
+	std::vector<int> radices;
+	std::vector<std::pair<int, int>> swaps;
+	std::vector<std::complex<float>> twiddles;
+};
+
+// The inverse of a real sequence of even `size` from its `size / 2 + 1`
+// non-negative frequency bins, done as a complex transform of half the size.
+struct RealFftPlan {
+	int size = 0;
+	const FftPlan* half = nullptr;
+	std::vector<std::complex<float>> twiddles;
+};
+
+auto makeFftPlan(int size) -> FftPlan;
+auto makeRealFftPlan(int size) -> RealFftPlan;
+
+// Built on first use for each size and kept for the life of the process
+auto fftPlan(int size) -> const FftPlan&;
+auto realFftPlan(int size) -> const RealFftPlan&;
+
+// How many complex values of scratch each transform needs
+auto fftScratchSize(const FftPlan& plan) -> int;
+auto realFftScratchSize(const RealFftPlan& plan) -> int;
+
+// Forward transform of `plan.size` values in place
+auto fft(const FftPlan& plan,
+		 std::complex<float>* data,
+		 std::complex<float>* scratch) -> void;
+
+// Writes the `plan.size` real values whose spectrum starts with `bins`. The
+// imaginary parts of the first and last bin are ignored, as they would be zero
+// for a real sequence.
+auto inverseRealFft(const RealFftPlan& plan,
+					const std::complex<float>* bins,
+					float* out,
+					std::complex<float>* scratch) -> void;
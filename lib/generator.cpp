@@ -0,0 +1,170 @@
+#include "generator.hpp"
+#include "engine.hpp"
+#include "random.hpp"
+
+#include <algorithm>
+
+OffsetGenerator::~OffsetGenerator() {
+	stopGenerator(*this);
+}
+
+// Builds for one generator at a time. A generator is never in the queue while
+// a worker is building for it, so no two workers build for the same one.
+auto runWorker(GeneratorPool& pool) -> void {
+	auto lock = std::unique_lock{pool.mutex};
+	while (true) {
+		pool.work.wait(lock,
+					   [&pool] { return pool.exit || !pool.queue.empty(); });
+		if (pool.exit) {
+			return;
+		}
+
+		auto& gen = *pool.queue.front();
+		pool.queue.pop_front();
+		const auto reseed = gen.pendingReseed;
+		gen.queued = false;
+		gen.running = true;
+		gen.pending = false;
+		gen.pendingReseed = false;
+		lock.unlock();
+
+		if (reseed) {
+			gen.state->seed.store(randomSeed());
+		}
+		applyState(*gen.state);
+
+		lock.lock();
+		gen.running = false;
+		if (gen.pending && !gen.stopped) {
+			gen.queued = true;
+			pool.queue.push_back(&gen);
+			pool.work.notify_one();
+		}
+		pool.done.notify_all();
+	}
+}
+
+GeneratorPool::GeneratorPool() {
+	for (auto i = 0; i < GeneratorThreads; ++i) {
+		threads.emplace_back([this] { runWorker(*this); });
+	}
+}
+
+GeneratorPool::~GeneratorPool() {
+	{
+		const auto lock = std::lock_guard{mutex};
+		exit = true;
+	}
+	work.notify_all();
+
+	for (auto& thread : threads) {
+		thread.join();
+	}
+}
+
+auto generatorPool() -> GeneratorPool& {
+	static auto pool = GeneratorPool{};
+	return pool;
+}
+
+auto startGenerator(State& state) -> void {
+	auto& pool = generatorPool();
+	const auto lock = std::lock_guard{pool.mutex};
+	state.generator.state = &state;
+	state.generator.stopped = false;
+}
+
+// Takes the generator out of the queue and waits for a build already running
+// for it, which is at most one table
+auto stopGenerator(OffsetGenerator& gen) -> void {
+	if (gen.state == nullptr) {
+		return;
+	}
+
+	auto& pool = generatorPool();
+	auto lock = std::unique_lock{pool.mutex};
+	gen.stopped = true;
+	if (gen.queued) {
+		std::erase(pool.queue, &gen);
+		gen.queued = false;
+	}
+	pool.done.wait(lock, [&gen] { return !gen.running; });
+}
+
+auto requestOffsets(OffsetGenerator& gen, const bool reseed) -> void {
+	if (gen.state == nullptr) {
+		return;
+	}
+
+	auto& pool = generatorPool();
+	const auto lock = std::lock_guard{pool.mutex};
+	if (gen.stopped) {
+		return;
+	}
+	gen.pending = true;
+	gen.pendingReseed |= reseed;
+	if (!gen.queued && !gen.running) {
+		gen.queued = true;
+		pool.queue.push_back(&gen);
+		pool.work.notify_one();
+	}
+}
+
+auto beginGeneration(OffsetGenerator& gen) -> std::uint64_t {
+	return gen.generations.fetch_add(1) + 1;
+}
+
+// Drops the table if a build that started later has already published. The
+// same table can be published more than once, or by other instances too,
+// since tables come from the sequence cache. Each reference in `retired` is
+// only ours, so dropping it never frees a table someone else still holds.
+auto publishOffsets(OffsetGenerator& gen,
+					std::shared_ptr<const FractalNoiseResult> next,
+					const std::uint64_t generation) -> bool {
+	const auto lock = std::lock_guard{gen.mutex};
+	if (generation < gen.publishedGeneration) {
+		return false;
+	}
+	gen.publishedGeneration = generation;
+
+	if (gen.latest) {
+		gen.retired.push_back(std::move(gen.latest));
+	}
+	gen.latest = std::move(next);
+	gen.preview = nullptr;
+	gen.published.store(gen.latest.get());
+
+	// Anything the audio thread isn't holding can go. The store above is
+	// ordered before this load, so if the audio thread publishes an older
+	// table as its hazard after we look, it will re-read `published` and
+	// switch to the new one instead of using it.
+	const auto* inUse = gen.hazard.load();
+	std::erase_if(gen.retired,
+				  [inUse](const auto& table) { return table.get() != inUse; });
+	return true;
+}
+
+auto publishPreview(OffsetGenerator& gen,
+					std::shared_ptr<const FractalNoiseResult> preview)
+	-> void {
+	const auto lock = std::lock_guard{gen.mutex};
+	gen.preview = std::move(preview);
+}
+
+auto acquireOffsets(OffsetGenerator& gen) -> const FractalNoiseResult* {
+	auto* table = gen.published.load();
+	while (true) {
+		gen.hazard.store(table);
+		auto* const current = gen.published.load();
+		if (current == table) {
+			return table;
+		}
+		table = current;
+	}
+}
+
+auto latestOffsets(OffsetGenerator& gen)
+	-> std::shared_ptr<const FractalNoiseResult> {
+	const auto lock = std::lock_guard{gen.mutex};
+	return gen.preview ? gen.preview : gen.latest;
+}
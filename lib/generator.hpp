@@ -0,0 +1,86 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+struct FractalNoiseResult;
+struct State;
+
+// Builds offset tables on a shared worker and hands them to the audio thread
+// through an atomic pointer. The audio thread marks the table it is reading in
+// `hazard`, so a retired table is only freed (on a worker or the message
+// thread) once the audio thread has moved on to a newer one.
+struct OffsetGenerator {
+	std::mutex mutex;
+
+	// Guarded by the pool's mutex. `queued` while waiting for a worker,
+	// `running` while one is building for us; a request in the meantime sets
+	// `pending` and puts us back in the queue once it's done.
+	State* state = nullptr;
+	bool pending = false;
+	bool pendingReseed = false;
+	bool queued = false;
+	bool running = false;
+	bool stopped = false;
+
+	// Every build takes the next generation as it starts, and a table is only
+	// published if nothing from a later build has been, so a slow build from
+	// before a state load can't replace the table the load published
+	std::atomic<std::uint64_t> generations = 0;
+	std::uint64_t publishedGeneration = 0;
+
+	std::atomic<const FractalNoiseResult*> published = nullptr;
+	std::atomic<const FractalNoiseResult*> hazard = nullptr;
+
+	std::shared_ptr<const FractalNoiseResult> latest;
+	std::vector<std::shared_ptr<const FractalNoiseResult>> retired;
+
+	// An approximate table for the editor to draw until the exact one for the
+	// same knobs is published. The audio thread never sees it.
+	std::shared_ptr<const FractalNoiseResult> preview;
+
+	~OffsetGenerator();
+};
+
+constexpr auto GeneratorThreads = 2;
+
+// A few threads that serve every instance in the process, taking generators
+// in the order they asked. A session with hundreds of instances still only
+// builds GeneratorThreads tables at once.
+struct GeneratorPool {
+	std::mutex mutex;
+	std::condition_variable work;
+	std::condition_variable done;
+	std::deque<OffsetGenerator*> queue;
+	std::vector<std::thread> threads;
+	bool exit = false;
+
+	GeneratorPool();
+	~GeneratorPool();
+};
+
+auto generatorPool() -> GeneratorPool&;
+
+auto startGenerator(State& state) -> void;
+auto stopGenerator(OffsetGenerator& gen) -> void;
+auto requestOffsets(OffsetGenerator& gen, bool reseed = false) -> void;
+auto beginGeneration(OffsetGenerator& gen) -> std::uint64_t;
+auto publishOffsets(OffsetGenerator& gen,
+					std::shared_ptr<const FractalNoiseResult> offsets,
+					std::uint64_t generation) -> bool;
+auto publishPreview(OffsetGenerator& gen,
+					std::shared_ptr<const FractalNoiseResult> preview) -> void;
+
+// Audio thread only. Never allocates, frees or blocks.
+auto acquireOffsets(OffsetGenerator& gen) -> const FractalNoiseResult*;
+
+// Any thread but the audio thread. The preview, if it's newer than the last
+// table published.
+auto latestOffsets(OffsetGenerator& gen)
+	-> std::shared_ptr<const FractalNoiseResult>;
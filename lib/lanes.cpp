@@ -0,0 +1,90 @@
+#include "lanes.hpp"
+#include "engine.hpp"
+
+#include <algorithm>
+
+// Channels past the last lane pass through dry.
+auto prepareLanes(State& ctx,
+				  const double sampleRate,
+				  const int maxBlockSize,
+				  const bool doublePrecision) -> void {
+	auto& lanes = ctx.lanes;
+	lanes.count =
+		std::min((ctx.numChannels + LaneWidth - 1) / LaneWidth, MaxLanes);
+
+	lanes.detectors = arenaVector<Detector>(ctx.arena, lanes.count);
+	for (auto& det : lanes.detectors) {
+		prepareDetector(det, ctx.arena, sampleRate, maxBlockSize,
+						doublePrecision);
+	}
+	lanes.currDelay = arenaVector<int>(ctx.arena, lanes.count);
+	std::ranges::fill(lanes.currDelay, -1);
+	lanes.pendingSamples = arenaVector<int>(ctx.arena, lanes.count);
+}
+
+// Switches multi-lane mode on or off, handing over how much is still in the
+// rings so the mode taking over drains it.
+auto switchLanes(State& ctx, const bool multiLane) -> void {
+	auto& lanes = ctx.lanes;
+	if (multiLane) {
+		std::ranges::fill(lanes.pendingSamples, ctx.pendingSamples);
+	} else if (!lanes.pendingSamples.empty()) {
+		ctx.pendingSamples = std::max(ctx.pendingSamples,
+									  std::ranges::max(lanes.pendingSamples));
+	}
+	ctx.multiLane = multiLane;
+}
+
+// One pass over the lanes. A lane with nothing coming in, nothing left in its
+// rings and no hit in progress costs a silence check and nothing else.
+template <typename SampleType>
+auto renderLanesT(State& ctx,
+				  const FractalNoiseResult& offsets,
+				  SampleType* const* channels,
+				  const int numChannels,
+				  const int numSamples) -> void {
+	auto& lanes = ctx.lanes;
+
+	for (auto lane = 0; lane < lanes.count; ++lane) {
+		const auto firstChannel = lane * LaneWidth;
+		const auto width = std::min(LaneWidth, numChannels - firstChannel);
+		if (width <= 0) {
+			break;
+		}
+
+		auto* const* laneChannels = channels + firstChannel;
+		auto& det = lanes.detectors[lane];
+		auto& pending = lanes.pendingSamples[lane];
+
+		const auto silent = isSilent(laneChannels, width, numSamples);
+		if (silent && pending == 0 && !det.open) {
+			skipDetector(det, numSamples);
+			continue;
+		}
+
+		runDetector(det, laneChannels, width, numSamples);
+		buildLaneSegments(ctx, offsets, det.events, DetectorEventType::Release,
+						  lane, lanes.currDelay[lane]);
+		renderSegments(ctx, ctx.segments.data(), (int)ctx.segments.size(),
+					   laneChannels, firstChannel, width, numSamples, silent,
+					   pending);
+	}
+
+	skipDelay(ctx, numSamples);
+}
+
+auto renderLanes(State& ctx,
+				 const FractalNoiseResult& offsets,
+				 float* const* channels,
+				 const int numChannels,
+				 const int numSamples) -> void {
+	renderLanesT(ctx, offsets, channels, numChannels, numSamples);
+}
+
+auto renderLanes(State& ctx,
+				 const FractalNoiseResult& offsets,
+				 double* const* channels,
+				 const int numChannels,
+				 const int numSamples) -> void {
+	renderLanesT(ctx, offsets, channels, numChannels, numSamples);
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include "arena.hpp"
+#include "detector.hpp"
+
+struct State;
+struct FractalNoiseResult;
+
+// Per-lane state for multi-lane mode, one entry per lane in each array. Lane i
+// owns channels [i * LaneWidth, (i + 1) * LaneWidth) of the main bus and their
+// rings; the read head, step tables and segment scratch are shared.
+struct Lanes {
+	int count = 0;
+	ArenaVector<Detector> detectors;
+	ArenaVector<int> currDelay;
+	ArenaVector<int> pendingSamples;
+};
+
+auto prepareLanes(State& ctx,
+				  double sampleRate,
+				  int maxBlockSize,
+				  bool doublePrecision = false) -> void;
+auto switchLanes(State& ctx, bool multiLane) -> void;
+auto renderLanes(State& ctx,
+				 const FractalNoiseResult& offsets,
+				 float* const* channels,
+				 int numChannels,
+				 int numSamples) -> void;
+auto renderLanes(State& ctx,
+				 const FractalNoiseResult& offsets,
+				 double* const* channels,
+				 int numChannels,
+				 int numSamples) -> void;
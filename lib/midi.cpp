@@ -0,0 +1,142 @@
+#include "midi.hpp"
+#include "engine.hpp"
+
+#include <juce_audio_basics/juce_audio_basics.h>
+
+#include <algorithm>
+#include <cmath>
+
+auto prepareMidi(MidiQueue& queue, Arena& arena) -> void {
+	queue.events = arenaVector<QueuedMidi>(arena, 0, MidiQueueSize);
+	queue.time = 0;
+	queue.noteOffsets.fill(0);
+	queue.lastHitTime = -1;
+	queue.lastHitOffset = 0;
+	queue.lastHitGain = 1.f;
+}
+
+// Keeps the queue sorted. Events almost always arrive later than everything
+// already queued, so the insert usually lands at the end and moves nothing.
+inline auto enqueue(MidiQueue& queue, const QueuedMidi& event) -> bool {
+	if (queue.events.size() >= queue.events.capacity()) {
+		return false;
+	}
+
+	const auto it = std::upper_bound(
+		queue.events.begin(), queue.events.end(), event.time,
+		[](const auto time, const auto& other) { return time < other.time; });
+	queue.events.insert(it, event);
+	return true;
+}
+
+// Emits everything due before `end` into `midi` and drops it from the queue.
+inline auto drain(MidiQueue& queue,
+				  juce::MidiBuffer& midi,
+				  const std::int64_t end) -> void {
+	auto due = 0;
+	for (const auto& event : queue.events) {
+		if (event.time >= end) {
+			break;
+		}
+		midi.addEvent(event.data.data(), event.size,
+					  (int)std::max<std::int64_t>(event.time - queue.time, 0));
+		++due;
+	}
+	queue.events.erase(queue.events.begin(), queue.events.begin() + due);
+}
+
+inline auto noteIndex(const juce::MidiMessage& message) -> int {
+	return (message.getChannel() - 1) * 128 + message.getNoteNumber();
+}
+
+// Every note on is a hit: it moves the sequence on a step and is shifted by
+// that step's offset and has its velocity scaled by that step's gain, exactly
+// like a hit the detector found in audio. Note offs follow their note on, and
+// everything else goes out untouched. The block's MIDI is rebuilt in `scratch`
+// and copied back into `midi`, so the preallocated scratch stays with the
+// processor.
+auto humanizeMidi(State& ctx,
+				  const FractalNoiseResult& offsets,
+				  juce::MidiBuffer& midi,
+				  juce::MidiBuffer& scratch,
+				  const int numSamples) -> void {
+	auto& queue = ctx.midi;
+	scratch.clear();
+
+	for (const auto metadata : midi) {
+		const auto message = metadata.getMessage();
+		const auto time = queue.time + metadata.samplePosition;
+		auto offset = 0;
+
+		if (message.isNoteOn()) {
+			if (time != queue.lastHitTime) {
+				ctx.currDelay = advanceHit(ctx, offsets.steps, ctx.currDelay,
+									   metadata.samplePosition);
+				const auto segment = stepSegmentAt(ctx, 0, ctx.currDelay);
+				queue.lastHitTime = time;
+				queue.lastHitOffset = std::max(hitDelay(ctx, segment), 0);
+				queue.lastHitGain = segment.gain;
+			}
+			offset = queue.lastHitOffset;
+			queue.noteOffsets[noteIndex(message)] = offset;
+		} else if (message.isNoteOff()) {
+			offset = queue.noteOffsets[noteIndex(message)];
+		}
+
+		auto event = QueuedMidi{time + offset, {}, metadata.numBytes};
+		const auto fits = event.size <= (int)event.data.size();
+		if (fits) {
+			std::copy_n(metadata.data, event.size, event.data.begin());
+		}
+		if (fits && message.isNoteOn() && queue.lastHitGain != 1.f) {
+			event.data[2] = (std::uint8_t)std::clamp(
+				(int)std::lround(event.data[2] * queue.lastHitGain), 1, 127);
+		}
+
+		// Sysex isn't timing sensitive and won't fit in the queue, and if the
+		// queue is full we'd rather play a note on time than drop it
+		if (!fits || !enqueue(queue, event)) {
+			scratch.addEvent(metadata.data, metadata.numBytes,
+							 metadata.samplePosition);
+		}
+	}
+
+	drain(queue, scratch, queue.time + numSamples);
+	queue.time += numSamples;
+
+	midi.clear();
+	midi.addEvents(scratch, 0, -1, 0);
+}
+
+// Sends whatever comes due in this block without taking anything new in. Used
+// outside MIDI mode so notes that were already queued still go out on time.
+auto drainMidi(MidiQueue& queue, juce::MidiBuffer& midi, const int numSamples)
+	-> void {
+	drain(queue, midi, queue.time + numSamples);
+	queue.time += numSamples;
+}
+
+// Stands in for runDetector when the hits are known from MIDI: every note on
+// in the `numSamples` from `start` is an onset at its exact sample, and note
+// ons on the same sample are one hit. The gate is closed in case we switched
+// over in the middle of a hit.
+auto detectMidiHits(Detector& det,
+					const juce::MidiBuffer& midi,
+					const int start,
+					const int numSamples) -> void {
+	det.events.clear();
+	det.open = false;
+
+	for (const auto metadata : midi) {
+		const auto pos = metadata.samplePosition - start;
+		if (pos < 0 || pos >= numSamples || !metadata.getMessage().isNoteOn()) {
+			continue;
+		}
+		if (!det.events.empty() && det.events.back().pos == pos) {
+			continue;
+		}
+		if (det.events.size() < det.events.capacity()) {
+			det.events.push_back({pos, DetectorEventType::Onset});
+		}
+	}
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include "arena.hpp"
+
+#include <array>
+#include <cstdint>
+
+namespace juce {
+class MidiBuffer;
+}
+
+struct State;
+struct FractalNoiseResult;
+struct Detector;
+
+constexpr auto MidiQueueSize = 4096;
+
+struct QueuedMidi {
+	std::int64_t time = 0;
+	std::array<std::uint8_t, 3> data{};
+	int size = 0;
+};
+
+// Events waiting to go out, ordered by the absolute sample they are due at so
+// a hit can be pushed past the end of the block it came in on. `time` counts
+// samples since prepareToPlay.
+struct MidiQueue {
+	ArenaVector<QueuedMidi> events;
+	std::int64_t time = 0;
+
+	// The offset each sounding note was given, so its note off moves with it
+	std::array<int, 16 * 128> noteOffsets{};
+
+	// Note ons that land on the same sample are one hit and share a step
+	std::int64_t lastHitTime = -1;
+	int lastHitOffset = 0;
+	float lastHitGain = 1.f;
+};
+
+auto prepareMidi(MidiQueue& queue, Arena& arena) -> void;
+auto humanizeMidi(State& ctx,
+				  const FractalNoiseResult& offsets,
+				  juce::MidiBuffer& midi,
+				  juce::MidiBuffer& scratch,
+				  int numSamples) -> void;
+auto drainMidi(MidiQueue& queue, juce::MidiBuffer& midi, int numSamples)
+	-> void;
+auto detectMidiHits(Detector& det,
+					const juce::MidiBuffer& midi,
+					int start,
+					int numSamples) -> void;
@@ -0,0 +1,23 @@
+#pragma once
+
+#include "spsc.hpp"
+
+#include <array>
+
+// The knobs the editor can move. The processor's parameters are the source
+// of truth; the editor only asks for changes through a ParamEditQueue.
+enum class ParamId { Alpha, Steps, Variance, Lookahead };
+
+constexpr auto ParamIds =
+	std::array<const char*, 4>{"alpha", "steps", "variance", "lookahead"};
+
+// A knob being grabbed, moved or let go, which the host sees as a gesture
+enum class ParamEditType { Begin, Set, End };
+
+struct ParamEdit {
+	ParamId param = ParamId::Alpha;
+	ParamEditType type = ParamEditType::Set;
+	float value = 0.f;
+};
+
+using ParamEditQueue = SpscQueue<ParamEdit, 256>;
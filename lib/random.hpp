@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstdint>
+#include <random>
+
+// SplitMix64's output function. Every draw below is a hash like this one
+// applied to a counter, so the n-th draw of a seed is known without drawing
+// the ones before it, and there is no generator state for threads to share.
+inline auto mixBits(std::uint64_t z) -> std::uint64_t {
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+	return z ^ (z >> 31);
+}
+
+// The `counter`-th draw of `seed`
+inline auto counterRandom(const std::uint64_t seed, const std::uint64_t counter)
+	-> std::uint64_t {
+	return mixBits(seed + (counter + 1) * 0x9e3779b97f4a7c15);
+}
+
+// A 32-bit integer hash (lowbias32). Only 32-bit multiplies, so a loop of
+// them vectorises on any SIMD instruction set.
+inline auto mix32(std::uint32_t x) -> std::uint32_t {
+	x = (x ^ (x >> 16)) * 0x7feb352d;
+	x = (x ^ (x >> 15)) * 0x846ca68b;
+	return x ^ (x >> 16);
+}
+
+// The `counter`-th draw of a 32-bit stream. Each stream's `key` is a 64-bit
+// draw of the seed.
+inline auto counterRandom32(const std::uint32_t key,
+							const std::uint32_t counter) -> std::uint32_t {
+	return mix32(key + counter * 0x9e3779b9);
+}
+
+// Steps a SplitMix64 generator, for state that only ever moves forward
+inline auto splitMix(std::uint64_t& state) -> std::uint64_t {
+	return mixBits(state += 0x9e3779b97f4a7c15);
+}
+
+// Uniform in [0, 1) from the top 24 bits
+inline auto unitFloat(const std::uint64_t bits) -> float {
+	return (float)(bits >> 40) / (float)(1 << 24);
+}
+
+inline auto unitFloat32(const std::uint32_t bits) -> float {
+	return (float)(std::int32_t)(bits >> 8) / (float)(1 << 24);
+}
+
+// A fresh seed for a new instance or a reseed
+inline auto randomSeed() -> std::uint64_t {
+	auto device = std::random_device{};
+	return ((std::uint64_t)device() << 32) | device();
+}
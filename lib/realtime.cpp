@@ -0,0 +1,191 @@
+#include "realtime.hpp"
+
+#ifdef REAL_HUMAN_BEAN_REALTIME_CHECKS
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+#if __has_include(<execinfo.h>)
+#include <execinfo.h>
+#endif
+
+#if defined(__GLIBC__)
+#include <dlfcn.h>
+#include <pthread.h>
+#endif
+
+namespace {
+thread_local auto realtimeDepth = 0;
+thread_local auto reporting = false;
+auto violations = std::atomic<std::size_t>{0};
+
+// Only touches a stack buffer and raw file descriptors, so it can't end up
+// back in here
+auto reportViolation(const char* what) -> void {
+	if (realtimeDepth == 0 || reporting) {
+		return;
+	}
+	reporting = true;
+	violations.fetch_add(1);
+
+	std::fprintf(stderr, "[!] %s on the audio thread\n", what);
+#if __has_include(<execinfo.h>)
+	void* frames[64];
+	const auto numFrames = backtrace(frames, 64);
+	backtrace_symbols_fd(frames, numFrames, 2);
+#endif
+
+	reporting = false;
+}
+}  // namespace
+
+RealtimeScope::RealtimeScope() {
+	++realtimeDepth;
+}
+
+RealtimeScope::~RealtimeScope() {
+	--realtimeDepth;
+}
+
+auto realtimeViolations() -> std::size_t {
+	return violations.load();
+}
+
+#if defined(__GLIBC__)
+extern "C" {
+auto __libc_malloc(std::size_t size) -> void*;
+auto __libc_calloc(std::size_t count, std::size_t size) -> void*;
+auto __libc_realloc(void* ptr, std::size_t size) -> void*;
+auto __libc_free(void* ptr) -> void;
+}
+
+// operator new and delete report themselves, so they go around our malloc
+inline auto rawMalloc(const std::size_t size) -> void* {
+	return __libc_malloc(size);
+}
+
+inline auto rawFree(void* ptr) -> void {
+	__libc_free(ptr);
+}
+
+extern "C" {
+auto malloc(const std::size_t size) -> void* {
+	reportViolation("malloc");
+	return __libc_malloc(size);
+}
+
+auto calloc(const std::size_t count, const std::size_t size) -> void* {
+	reportViolation("calloc");
+	return __libc_calloc(count, size);
+}
+
+auto realloc(void* ptr, const std::size_t size) -> void* {
+	reportViolation("realloc");
+	return __libc_realloc(ptr, size);
+}
+
+auto free(void* ptr) -> void {
+	if (ptr != nullptr) {
+		reportViolation("free");
+	}
+	__libc_free(ptr);
+}
+
+auto pthread_mutex_lock(pthread_mutex_t* mutex) -> int {
+	using MutexLock = int (*)(pthread_mutex_t*);
+	static const auto next =
+		reinterpret_cast<MutexLock>(dlsym(RTLD_NEXT, "pthread_mutex_lock"));
+
+	reportViolation("pthread_mutex_lock");
+	return next(mutex);
+}
+}
+#else
+inline auto rawMalloc(const std::size_t size) -> void* {
+	return std::malloc(size);
+}
+
+inline auto rawFree(void* ptr) -> void {
+	std::free(ptr);
+}
+#endif
+
+auto operator new(const std::size_t size) -> void* {
+	reportViolation("operator new");
+	if (auto* const ptr = rawMalloc(size == 0 ? 1 : size)) {
+		return ptr;
+	}
+	throw std::bad_alloc{};
+}
+
+auto operator new[](const std::size_t size) -> void* {
+	return ::operator new(size);
+}
+
+auto operator new(const std::size_t size, const std::align_val_t alignment)
+	-> void* {
+	reportViolation("operator new");
+	const auto align = static_cast<std::size_t>(alignment);
+	const auto rounded = (std::max(size, std::size_t{1}) + align - 1) /
+						 align * align;
+	if (auto* const ptr = std::aligned_alloc(align, rounded)) {
+		return ptr;
+	}
+	throw std::bad_alloc{};
+}
+
+auto operator new[](const std::size_t size, const std::align_val_t alignment)
+	-> void* {
+	return ::operator new(size, alignment);
+}
+
+auto operator delete(void* ptr) noexcept -> void {
+	if (ptr != nullptr) {
+		reportViolation("operator delete");
+	}
+	rawFree(ptr);
+}
+
+auto operator delete[](void* ptr) noexcept -> void {
+	::operator delete(ptr);
+}
+
+auto operator delete(void* ptr, std::size_t) noexcept -> void {
+	::operator delete(ptr);
+}
+
+auto operator delete[](void* ptr, std::size_t) noexcept -> void {
+	::operator delete(ptr);
+}
+
+auto operator delete(void* ptr, std::align_val_t) noexcept -> void {
+	::operator delete(ptr);
+}
+
+auto operator delete[](void* ptr, std::align_val_t) noexcept -> void {
+	::operator delete(ptr);
+}
+
+auto operator delete(void* ptr, std::size_t, std::align_val_t) noexcept
+	-> void {
+	::operator delete(ptr);
+}
+
+auto operator delete[](void* ptr, std::size_t, std::align_val_t) noexcept
+	-> void {
+	::operator delete(ptr);
+}
+
+#else
+
+RealtimeScope::RealtimeScope() = default;
+RealtimeScope::~RealtimeScope() = default;
+
+auto realtimeViolations() -> std::size_t {
+	return 0;
+}
+
+#endif
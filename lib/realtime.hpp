@@ -0,0 +1,24 @@
+#pragma once
+
+#include <cstddef>
+
+// Catches the audio thread allocating, freeing or taking a lock. Built in
+// when REAL_HUMAN_BEAN_REALTIME_CHECKS is set: operator new and delete are
+// replaced, and on glibc so are malloc, free and pthread_mutex_lock, and any
+// of them called inside a RealtimeScope prints a stack trace to stderr.
+// Otherwise a RealtimeScope costs nothing. Elsewhere, macOS included, only
+// new and delete are caught, so a raw malloc or a std::mutex goes unnoticed;
+// run the checks on Linux to cover those.
+//
+// Replacing them only takes effect for the executable that links this file,
+// which for the plugin means a statically linked standalone or the test app.
+struct RealtimeScope {
+	RealtimeScope();
+	~RealtimeScope();
+
+	RealtimeScope(const RealtimeScope&) = delete;
+	auto operator=(const RealtimeScope&) -> RealtimeScope& = delete;
+};
+
+// How many violations have been reported since the program started
+auto realtimeViolations() -> std::size_t;
@@ -0,0 +1,101 @@
+#include "sequences.hpp"
+#include "engine.hpp"
+
+#include <cmath>
+#include <functional>
+
+auto SequenceKeyHash::operator()(const SequenceKey& key) const
+	-> std::size_t {
+	auto hash = std::hash<std::uint64_t>{}(key.seed);
+	for (const auto value : {key.steps, key.alpha, key.dynamicsAlpha}) {
+		hash = hash * 31 + std::hash<std::int32_t>{}(value);
+	}
+	return hash;
+}
+
+auto sequenceCache() -> SequenceCache& {
+	static auto cache = SequenceCache{};
+	return cache;
+}
+
+auto quantizeAlpha(const float knob) -> std::int32_t {
+	return (std::int32_t)std::lround(knob * AlphaSteps);
+}
+
+auto alphaFromKey(const std::int32_t alpha) -> float {
+	return (float)alpha / AlphaSteps;
+}
+
+// Roughly what a sequence holds on to, to weigh it against the budget
+inline auto sequenceBytes(const FractalNoiseResult& sequence) -> std::size_t {
+	const auto floats = [](const std::vector<float>& values) {
+		return values.capacity() * sizeof(float);
+	};
+
+	auto bytes = sizeof(sequence) + floats(sequence.frequencies) +
+				 floats(sequence.spectrum) + floats(sequence.offsets) +
+				 floats(sequence.normOffsets) +
+				 floats(sequence.laneMinOffsets);
+	for (const auto& lane : sequence.laneOffsets) {
+		bytes += sizeof(lane) + floats(lane);
+	}
+	for (const auto& lane : sequence.laneGains) {
+		bytes += sizeof(lane) + floats(lane);
+	}
+	return bytes;
+}
+
+// Drops the least recently used sequences until we're back under budget.
+// Sequences still being generated weigh nothing yet and are left alone.
+inline auto evict(SequenceCache& cache) -> void {
+	auto it = cache.entries.end();
+	while (cache.bytes > cache.budget && it != cache.entries.begin()) {
+		--it;
+		if (it->bytes == 0) {
+			continue;
+		}
+		cache.bytes -= it->bytes;
+		cache.index.erase(it->key);
+		it = cache.entries.erase(it);
+	}
+}
+
+// The lock only covers finding or adding the entry and moving it to the front.
+// Generating happens outside it, so a miss never holds up anyone else's hit.
+auto acquireSequence(SequenceCache& cache,
+					 const SequenceKey& key,
+					 const SequenceMaker make) -> SequenceHandle {
+	auto promise = std::promise<SequenceHandle>{};
+	auto existing = std::shared_future<SequenceHandle>{};
+	{
+		const auto lock = std::lock_guard{cache.mutex};
+		if (const auto found = cache.index.find(key);
+			found != cache.index.end()) {
+			cache.entries.splice(cache.entries.begin(), cache.entries,
+								 found->second);
+			existing = found->second->sequence;
+			++cache.hits;
+		} else {
+			cache.entries.push_front({key, promise.get_future().share()});
+			cache.index.emplace(key, cache.entries.begin());
+			++cache.misses;
+		}
+	}
+
+	// Waits here if someone else is still generating it
+	if (existing.valid()) {
+		return existing.get();
+	}
+
+	auto sequence = std::make_shared<const FractalNoiseResult>(make(key));
+	promise.set_value(sequence);
+
+	const auto lock = std::lock_guard{cache.mutex};
+	if (const auto found = cache.index.find(key);
+		found != cache.index.end()) {
+		found->second->bytes = sequenceBytes(*sequence);
+		cache.bytes += found->second->bytes;
+		evict(cache);
+	}
+	return sequence;
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <future>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+struct FractalNoiseResult;
+
+constexpr auto SequenceCacheBytes = std::size_t{16} << 20;
+constexpr auto AlphaSteps = 4096;
+
+// Everything a sequence is generated from. Alphas are knob values quantized to
+// 1 / AlphaSteps, so knobs that only differ in the last few bits share one.
+struct SequenceKey {
+	int steps = 0;
+	std::int32_t alpha = 0;
+	std::int32_t dynamicsAlpha = 0;
+	std::uint64_t seed = 0;
+
+	auto operator==(const SequenceKey&) const -> bool = default;
+};
+
+struct SequenceKeyHash {
+	auto operator()(const SequenceKey& key) const -> std::size_t;
+};
+
+using SequenceHandle = std::shared_ptr<const FractalNoiseResult>;
+using SequenceMaker = auto (*)(const SequenceKey& key) -> FractalNoiseResult;
+
+// Sequences every instance in the process has asked for, most recently used
+// first. A sequence still being generated is in here too, so anyone else
+// asking for it waits for that one instead of generating it again. Evicting a
+// sequence only drops the cache's handle; instances playing it keep theirs.
+struct SequenceCache {
+	struct Entry {
+		SequenceKey key;
+		std::shared_future<SequenceHandle> sequence;
+		std::size_t bytes = 0;
+	};
+
+	std::mutex mutex;
+	std::list<Entry> entries;
+	std::unordered_map<SequenceKey, std::list<Entry>::iterator, SequenceKeyHash>
+		index;
+	std::size_t bytes = 0;
+	std::size_t budget = SequenceCacheBytes;
+	std::size_t hits = 0;
+	std::size_t misses = 0;
+};
+
+// The one every instance in the process shares
+auto sequenceCache() -> SequenceCache&;
+
+auto quantizeAlpha(float knob) -> std::int32_t;
+auto alphaFromKey(std::int32_t alpha) -> float;
+
+// Returns the sequence for `key`, calling `make` to generate it only if no one
+// has yet. Never call this on the audio thread.
+auto acquireSequence(SequenceCache& cache,
+					 const SequenceKey& key,
+					 SequenceMaker make) -> SequenceHandle;
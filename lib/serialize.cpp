@@ -7,7 +7,9 @@
 
 #include <juce_core/juce_core.h>
 
-auto serialize(juce::MemoryBlock& block, State& context) -> void {
+auto serialize(juce::MemoryBlock& block,
+			   State& context,
+			   const juce::XmlElement& params) -> void {
 	auto stream = juce::MemoryOutputStream{block, false};
 	stream.writeInt(Version);
 
@@ -20,13 +22,16 @@ auto serialize(juce::MemoryBlock& block, State& context) -> void {
 		stream.writeFloat(context.lookahead.load());
 
 		applyState(context);
+	} else if constexpr (Version == Version_3) {
+		stream.writeInt64((juce::int64)context.seed.load());
+		stream.writeString(params.toString());
 	} else {
 		throw std::runtime_error{"serialize(): Unsupported version " + Version};
 	}
 }
 
 auto deserialize(const void* data, const int sizeInBytes, State& context)
-	-> void {
+	-> std::unique_ptr<juce::XmlElement> {
 	auto stream = juce::MemoryInputStream{data, (size_t)sizeInBytes, false};
 	const auto version = stream.readInt();
 
@@ -39,8 +44,12 @@ auto deserialize(const void* data, const int sizeInBytes, State& context)
 		context.lookahead.store(stream.readFloat());
 
 		applyState(context);
+	} else if (version == Version_3) {
+		context.seed.store((std::uint64_t)stream.readInt64());
+		return juce::parseXML(stream.readString());
 	} else {
 		std::cerr << "deserialize(): Unsupported version " + version
 				  << std::endl;
 	}
+	return nullptr;
 }
\ No newline at end of file
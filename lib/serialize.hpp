@@ -6,7 +6,16 @@
 
 #include <juce_core/juce_core.h>
 
+#include <memory>
+
 struct State;
 
-auto serialize(juce::MemoryBlock& block, State& context) -> void;
-auto deserialize(const void* data, int sizeInBytes, State& context) -> void;
+// From Version_3 on the parameters are saved as they are, as `params`, along
+// with the seed. Loading such a state hands the parameters back for the
+// caller to restore; older states have no parameters beyond the four knobs,
+// which are loaded into `context` as before, and give back null.
+auto serialize(juce::MemoryBlock& block,
+			   State& context,
+			   const juce::XmlElement& params) -> void;
+auto deserialize(const void* data, int sizeInBytes, State& context)
+	-> std::unique_ptr<juce::XmlElement>;
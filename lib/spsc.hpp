@@ -0,0 +1,41 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+
+// Fixed size single producer, single consumer queue. Neither side allocates,
+// locks or waits; a push onto a full queue fails instead.
+template <typename T, std::size_t Capacity>
+struct SpscQueue {
+	static_assert((Capacity & (Capacity - 1)) == 0,
+				  "Capacity must be a power of two");
+
+	std::array<T, Capacity> items{};
+	std::atomic<std::size_t> head = 0;  // Next to pop
+	std::atomic<std::size_t> tail = 0;  // Next to push
+};
+
+template <typename T, std::size_t Capacity>
+auto spscPush(SpscQueue<T, Capacity>& queue, const T& item) -> bool {
+	const auto tail = queue.tail.load(std::memory_order_relaxed);
+	if (tail - queue.head.load(std::memory_order_acquire) == Capacity) {
+		return false;
+	}
+
+	queue.items[tail & (Capacity - 1)] = item;
+	queue.tail.store(tail + 1, std::memory_order_release);
+	return true;
+}
+
+template <typename T, std::size_t Capacity>
+auto spscPop(SpscQueue<T, Capacity>& queue, T& item) -> bool {
+	const auto head = queue.head.load(std::memory_order_relaxed);
+	if (head == queue.tail.load(std::memory_order_acquire)) {
+		return false;
+	}
+
+	item = queue.items[head & (Capacity - 1)];
+	queue.head.store(head + 1, std::memory_order_release);
+	return true;
+}
@@ -0,0 +1,105 @@
+#include "stream.hpp"
+#include "engine.hpp"
+#include "random.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+
+// Uniform in [-1, 1)
+inline auto uniform(std::uint64_t& state) -> float {
+	return unitFloat(splitMix(state)) * 2.f - 1.f;
+}
+
+// Neighbouring rows overlap in frequency, so the sum comes out flatter than
+// the weights alone would give, by an amount that is linear in alpha over the
+// range the knob covers. The weights are set for the alpha that, measured over
+// 2^20 hits, gives back the one asked for. Each row is uniform, so contributes
+// a variance of its weight squared over 3.
+auto makeStreamShape(const float alpha) -> StreamShape {
+	const auto rowAlpha = (alpha - 0.358f) / 0.654f;
+
+	auto shape = StreamShape{};
+	auto variance = 0.f;
+	for (auto row = 0; row < StreamRows; ++row) {
+		shape.weights[row] =
+			std::pow(2.f, -(float)row * (1.f - rowAlpha) / 2.f);
+		variance += shape.weights[row] * shape.weights[row] / 3.f;
+	}
+	shape.scale = 1.f / std::sqrt(variance);
+	return shape;
+}
+
+inline auto seedStream(VossStream& stream, const std::uint64_t seed) -> void {
+	stream.rng = seed;
+	for (auto& row : stream.rows) {
+		row = uniform(stream.rng);
+	}
+	stream.count = 0;
+	stream.value = 0.f;
+}
+
+// Every lane gets streams of its own, which restart from their first hit
+auto seedStreams(State& ctx, const std::uint64_t seed) -> void {
+	ctx.streamSeed = seed;
+	auto rng = seed;
+	for (auto& lane : ctx.streams) {
+		seedStream(lane.offsets, splitMix(rng));
+		seedStream(lane.gains, splitMix(rng));
+		lane.started = false;
+	}
+}
+
+auto updateStreamShapes(State& ctx) -> void {
+	if (const auto seed = ctx.seed.load(); seed != ctx.streamSeed) {
+		seedStreams(ctx, seed);
+	}
+	if (const auto alpha = ctx.alpha.load(); alpha != ctx.streamAlpha) {
+		ctx.offsetShape = makeStreamShape(alpha * 0.3f + 0.5f);
+		ctx.streamAlpha = alpha;
+	}
+	if (const auto alpha = ctx.dynamicsAlpha.load();
+		alpha != ctx.streamDynamicsAlpha) {
+		ctx.gainShape = makeStreamShape(alpha * 0.3f + 0.5f);
+		ctx.streamDynamicsAlpha = alpha;
+	}
+}
+
+// Unit deviation, clamped to StreamRange
+inline auto nextValue(VossStream& stream, const StreamShape& shape) -> float {
+	stream.rows[0] = uniform(stream.rng);
+	if (++stream.count != 0) {
+		const auto row =
+			std::min(std::countr_zero(stream.count) + 1, StreamRows - 1);
+		stream.rows[row] = uniform(stream.rng);
+	}
+
+	auto sum = 0.f;
+	for (auto row = 0; row < StreamRows; ++row) {
+		sum += shape.weights[row] * stream.rows[row];
+	}
+	return std::clamp(sum * shape.scale, -StreamRange, StreamRange);
+}
+
+auto advanceStream(State& ctx, const int lane) -> void {
+	auto& stream = ctx.streams[lane];
+	stream.offsets.value = nextValue(stream.offsets, ctx.offsetShape);
+	stream.gains.value = nextValue(stream.gains, ctx.gainShape);
+	stream.started = true;
+}
+
+// The knobs are applied here rather than when the value is drawn, so a hit
+// follows variance and lookahead automation the same way a table step does
+auto streamSegmentAt(const State& ctx, const int start, const int lane)
+	-> HitSegment {
+	const auto& stream = ctx.streams[lane];
+	if (!stream.started) {
+		return {start, ctx.latencySamples, 0, 1.f};
+	}
+
+	const auto offset = offsetAt(stream.offsets.value * OffsetStd,
+								 -StreamRange * OffsetStd, ctx.variance,
+								 ctx.lookahead);
+	return placeHit(ctx, start, offset,
+					gainAt(ctx.dynamics, stream.gains.value));
+}
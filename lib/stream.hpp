@@ -0,0 +1,51 @@
+#pragma once
+
+#include "delay.hpp"
+
+#include <array>
+#include <cstdint>
+
+struct State;
+
+constexpr auto StreamRows = 16;
+
+// Streamed values are clamped to this many deviations, which gives the
+// latency in compensated mode a bound
+constexpr auto StreamRange = 2.5f;
+
+// Voss-McCartney: row 0 is redrawn every hit and row j every 2^j hits, so each
+// row holds its value for twice as long as the one before. Weighting row j by
+// 2^(-j (1 - alpha) / 2) makes the sum's power fall close to 1/f^alpha over the
+// StreamRows octaves the rows cover. Each hit redraws at most two rows and
+// sums StreamRows, however long the stream has been running.
+struct VossStream {
+	std::array<float, StreamRows> rows{};
+	std::uint32_t count = 0;
+	std::uint64_t rng = 0;
+	float value = 0.f;
+};
+
+// Row weights for one alpha, shared by every stream on it
+struct StreamShape {
+	std::array<float, StreamRows> weights{};
+	float scale = 1.f;
+};
+
+// A lane's offsets and gains in streaming mode
+struct StreamLane {
+	VossStream offsets;
+	VossStream gains;
+	bool started = false;
+};
+
+auto makeStreamShape(float alpha) -> StreamShape;
+auto seedStreams(State& ctx, std::uint64_t seed) -> void;
+
+// Picks up a change of either alpha, or of the seed. Audio thread only.
+auto updateStreamShapes(State& ctx) -> void;
+
+// Moves `lane` on to its next hit
+auto advanceStream(State& ctx, int lane) -> void;
+
+// The segment starting at `start` for `lane`'s current hit
+auto streamSegmentAt(const State& ctx, int start, int lane) -> HitSegment;
@@ -23,15 +23,20 @@ inline auto valueHasChanged(const float value, const float prevValue) -> bool {
 }
 
 inline auto applyStateToUi(Ui& ui,
-						   const State& state,
+						   State& state,
 						   const GraphicsContext& graphics) -> void {
-	setTextureData(graphics.powerTexId, state.offsets.spectrum.data(),
-				   state.offsets.spectrum.size());
-	setTextureData(graphics.offsetGraphTexId, state.offsets.normOffsets.data(),
-				   state.offsets.normOffsets.size());
+	ui.offsets = latestOffsets(state.generator);
+	if (!ui.offsets) {
+		return;
+	}
+
+	setTextureData(graphics.powerTexId, ui.offsets->spectrum.data(),
+				   ui.offsets->spectrum.size());
+	setTextureData(graphics.offsetGraphTexId, ui.offsets->normOffsets.data(),
+				   ui.offsets->normOffsets.size());
 
 	ui.cells.clear();
-	for (auto i = 0; i < state.stepsI; ++i) {
+	for (auto i = 0; i < ui.offsets->steps; ++i) {
 		const auto cell =
 			glm::vec2{i % OffsetDiagramCols, i / OffsetDiagramCols};
 		const auto cellPos =
@@ -53,22 +58,51 @@ auto setupUi(Ui& ui) -> void {
 	ui.labelKnobDesc = quadFromPsQuad({336, 423}, {826, 62});
 }
 
-auto updateUi(Ui& ui, State& state, const GraphicsContext& graphics) -> void {
-	state.variance.store(ui.knobVariance.value);
-	state.lookahead.store(ui.knobLookahead.value);
+constexpr auto KnobSettleFrames = 30;
+
+// While a knob is held its moves are sent to the processor as edits.
+// Otherwise it follows the engine's copy of the parameter, so automation and
+// presets show up on it.
+inline auto syncKnob(Ui& ui,
+					 State& state,
+					 Knob& knob,
+					 const ParamId param,
+					 const std::atomic<float>& value) -> void {
+	auto& editing = ui.knobEditing[(int)param];
+	auto& sent = ui.knobSent[(int)param];
+	auto& settling = ui.knobSettling[(int)param];
+
+	if (knob.rotating) {
+		if (!editing) {
+			spscPush(state.paramEdits, {param, ParamEditType::Begin});
+			editing = true;
+			sent = value.load();
+		}
+		if (valueHasChanged(sent, knob.value) &&
+			spscPush(state.paramEdits,
+					 {param, ParamEditType::Set, knob.value})) {
+			sent = knob.value;
+		}
+	} else {
+		if (editing) {
+			spscPush(state.paramEdits, {param, ParamEditType::End});
+			editing = false;
+			settling = KnobSettleFrames;
+		}
+		if (settling > 0) {
+			settling = valueHasChanged(value.load(), sent) ? settling - 1 : 0;
+		} else if (valueHasChanged(value.load(), knob.value)) {
+			knobInitWithValue(knob, value.load());
+		}
+	}
+}
 
+auto updateUi(Ui& ui, State& state, const GraphicsContext& graphics) -> void {
 	if (ui.buttonReseed.events & EventMousePressed) {
-		state.queuedSeedRecalc.store(true);
+		requestOffsets(state.generator, true);
 		ui.buttonReseed.events = 0;
 	}
 
-	if (valueHasChanged(state.alpha.load(), ui.knobAlpha.value) ||
-		valueHasChanged(state.steps.load(), ui.knobSteps.value)) {
-		state.alpha.store(ui.knobAlpha.value);
-		state.steps.store(ui.knobSteps.value);
-		state.queuedOffsetRecalc.store(true);
-	}
-
 	if (state.eventOffsetsUpdated.load() || ui.isFresh) {
 		applyStateToUi(ui, state, graphics);
 		state.eventOffsetsUpdated.store(false);
@@ -79,6 +113,12 @@ auto updateUi(Ui& ui, State& state, const GraphicsContext& graphics) -> void {
 	knobUpdate(ui.knobVariance, ui.mouse);
 	knobUpdate(ui.knobLookahead, ui.mouse);
 
+	syncKnob(ui, state, ui.knobAlpha, ParamId::Alpha, state.alpha);
+	syncKnob(ui, state, ui.knobSteps, ParamId::Steps, state.steps);
+	syncKnob(ui, state, ui.knobVariance, ParamId::Variance, state.variance);
+	syncKnob(ui, state, ui.knobLookahead, ParamId::Lookahead,
+			 state.lookahead);
+
 	buttonUpdate(ui.buttonReseed, ui.mouse);
 
 	if (ui.knobAlpha.hovered) {
@@ -163,7 +203,7 @@ auto renderUi(Ui& ui, const State& state, const GraphicsContext& graphics)
 		glDrawArrays(GL_TRIANGLES, 0, 6);
 
 		auto offsetQuad = pair;
-		offsetQuad.pos.x += getOffsetAt(state, i) / 100.f;
+		offsetQuad.pos.x += getOffsetAt(state, *ui.offsets, i) / 100.f;
 
 		model = quadToModel(offsetQuad);
 		setUniform(graphics.shader.id, "model", model);
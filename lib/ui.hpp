@@ -11,10 +11,13 @@
 
 #include <glm/glm.hpp>
 
+#include <array>
+#include <memory>
 #include <vector>
 
 struct State;
 struct GraphicsContext;
+struct FractalNoiseResult;
 
 struct Ui {
 	glm::ivec2 windowSize;
@@ -31,6 +34,14 @@ struct Ui {
 	Quad labelKnobDesc;
 	Button buttonReseed;
 	std::vector<Quad> cells;
+	std::shared_ptr<const FractalNoiseResult> offsets;
+
+	// Whether each knob (alpha, steps, variance, lookahead) is mid gesture,
+	// the value we last asked the processor for, and how many more frames a
+	// released knob waits for the processor to catch up with it
+	std::array<bool, 4> knobEditing{};
+	std::array<float, 4> knobSent{};
+	std::array<int, 4> knobSettling{};
 
 	unsigned int currDescTex = 0;
 };
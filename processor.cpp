@@ -5,21 +5,30 @@
 #include "processor.hpp"
 #include "editor.hpp"
 
+#include "lib/delay.hpp"
+#include "lib/detector.hpp"
 #include "lib/engine.hpp"
 #include "lib/log.hpp"
+#include "lib/midi.hpp"
+#include "lib/random.hpp"
+#include "lib/realtime.hpp"
 #include "lib/serialize.hpp"
 #include "lib/ui.hpp"
 
 #include <assert.h>
+#include <cmath>
 #include <fstream>
 
-constexpr auto cutoff = 0.00001f;
-constexpr auto attack = 50;
-
 auto paramFloat(const std::string& name, float defaultValue)
 	-> std::unique_ptr<juce::AudioParameterFloat> {
 	return std::make_unique<juce::AudioParameterFloat>(
-		juce::ParameterID{name, Version}, name, 0.f, 1.f, defaultValue);
+		juce::ParameterID{name, Version_2}, name, 0.f, 1.f, defaultValue);
+}
+
+auto paramBool(const std::string& name, bool defaultValue)
+	-> std::unique_ptr<juce::AudioParameterBool> {
+	return std::make_unique<juce::AudioParameterBool>(
+		juce::ParameterID{name, Version_2}, name, defaultValue);
 }
 
 Processor::Processor()
@@ -29,12 +38,20 @@ Processor::Processor()
 									true)
 						 .withOutput("Output",
 									 juce::AudioChannelSet::stereo(),
-									 true)},
+									 true)
+						 .withInput("Sidechain",
+									juce::AudioChannelSet::stereo(),
+									false)},
 	  params{*this,
 			 nullptr,
 			 juce::Identifier{"real-human-bean-vst"},
 			 {paramFloat("alpha", 0.27f), paramFloat("steps", 0.4f),
-			  paramFloat("variance", 0.78f), paramFloat("lookahead", 0.5f)}},
+			  paramFloat("variance", 0.78f), paramFloat("lookahead", 0.5f),
+			  paramBool("fractional", false), paramBool("compensated", false),
+			  paramBool("midi", false), paramBool("midiTrigger", false),
+			  paramBool("multiLane", false), paramBool("timeline", false),
+			  paramFloat("dynamics", 0.f), paramFloat("dynamicsAlpha", 0.5f),
+			  paramBool("streaming", false)}},
 	  ctx{} {
 #ifndef DEBUG
 	const auto logDir =
@@ -53,31 +70,109 @@ Processor::Processor()
 							 "/log - " + currTimeStr + ".txt";
 	writeStdOutToFile(logFilePath);
 #endif
+	_alpha = params.getRawParameterValue("alpha");
+	_steps = params.getRawParameterValue("steps");
+	_variance = params.getRawParameterValue("variance");
+	_lookahead = params.getRawParameterValue("lookahead");
+	_fractional = params.getRawParameterValue("fractional");
+	_compensated = params.getRawParameterValue("compensated");
+	_midiMode = params.getRawParameterValue("midi");
+	_midiTrigger = params.getRawParameterValue("midiTrigger");
+	_multiLane = params.getRawParameterValue("multiLane");
+	_timeline = params.getRawParameterValue("timeline");
+	_dynamics = params.getRawParameterValue("dynamics");
+	_dynamicsAlpha = params.getRawParameterValue("dynamicsAlpha");
+	_streaming = params.getRawParameterValue("streaming");
+
+	ctx.alpha.store(_alpha->load());
+	ctx.steps.store(_steps->load());
+	ctx.variance.store(_variance->load());
+	ctx.lookahead.store(_lookahead->load());
+	ctx.dynamicsAlpha.store(_dynamicsAlpha->load());
+	ctx.seed.store(randomSeed());
+
+	applyState(ctx);
+	startGenerator(ctx);
+	startTimerHz(60);
 	std::cout << "[*] Initialized audio processor" << std::endl;
 }
 
 Processor::~Processor() {
+	stopTimer();
 	std::cout << "[*] Destroying audio processor" << std::endl;
 };
 
+// Runs on the message thread. Reports the audio thread's latency, hands the
+// editor's knob edits to the host as parameter changes, and regenerates the
+// sequence when the parameters that shape it have moved, whether the editor or
+// automation moved them.
+auto Processor::timerCallback() -> void {
+	if (const auto latency = ctx.latency.load();
+		latency != getLatencySamples()) {
+		setLatencySamples(latency);
+	}
+
+	// Whether the editor moved a knob that shapes the sequence this tick
+	auto shaped = false;
+	auto edit = ParamEdit{};
+	while (spscPop(ctx.paramEdits, edit)) {
+		auto* const param = params.getParameter(ParamIds[(int)edit.param]);
+		switch (edit.type) {
+			case ParamEditType::Begin:
+				param->beginChangeGesture();
+				break;
+			case ParamEditType::Set:
+				param->setValueNotifyingHost(edit.value);
+				shaped = shaped || edit.param == ParamId::Alpha ||
+						 edit.param == ParamId::Steps;
+				break;
+			case ParamEditType::End:
+				param->endChangeGesture();
+				break;
+		}
+	}
+
+	const auto alpha = _alpha->load();
+	const auto steps = _steps->load();
+	const auto dynamicsAlpha = _dynamicsAlpha->load();
+	if (alpha != ctx.alpha.load() || steps != ctx.steps.load() ||
+		dynamicsAlpha != ctx.dynamicsAlpha.load()) {
+		ctx.alpha.store(alpha);
+		ctx.steps.store(steps);
+		ctx.dynamicsAlpha.store(dynamicsAlpha);
+
+		// While the user drags a knob, the bank lets the editor draw the new
+		// table on its next frame. Automation, or nobody watching, just waits
+		// for the generator, which is what plays either way.
+		if (shaped && getActiveEditor() != nullptr) {
+			previewState(ctx);
+		}
+		requestOffsets(ctx.generator);
+	}
+}
+
 auto Processor::getName() const -> const juce::String {
 	return JucePlugin_Name;
 }
 
 auto Processor::acceptsMidi() const -> bool {
-	return false;
+	return true;
 }
 
 auto Processor::producesMidi() const -> bool {
-	return false;
+	return true;
 }
 
 auto Processor::isMidiEffect() const -> bool {
 	return false;
 }
 
+// A hit can come out as late as the furthest offset the knobs can reach,
+// latency included
 auto Processor::getTailLengthSeconds() const -> double {
-	return 0.0;
+	const auto sampleRate =
+		getSampleRate() > 0.0 ? getSampleRate() : ReferenceSampleRate;
+	return (double)(maxOffsetSamples(sampleRate) + FracTaps + 1) / sampleRate;
 }
 
 auto Processor::getNumPrograms() -> int {
@@ -105,8 +200,33 @@ auto Processor::changeProgramName(int index, const juce::String& newName)
 auto Processor::prepareToPlay(const double sampleRate,
 							  const int samplesPerBlock) -> void {
 	_sampleRate = static_cast<int>(sampleRate);
-	_delayBuffer.setSize(2, _sampleRate);
-	_delayBuffer.clear();
+	const auto doublePrecision = isUsingDoublePrecision();
+
+	// Every buffer the audio thread touches is rebuilt in a new generation of
+	// the arena; the old one goes once they all have
+	beginArena(ctx.arena);
+	prepareDelay(ctx, sampleRate, getMainBusNumInputChannels(),
+				 samplesPerBlock, doublePrecision);
+
+	prepareLanes(ctx, sampleRate, samplesPerBlock, doublePrecision);
+	ctx.multiLane = _multiLane->load() > 0.5f;
+
+	// Let the host know our latency before the first block
+	if (const auto* offsets = acquireOffsets(ctx.generator)) {
+		ctx.compensated = _compensated->load() > 0.5f;
+		updateStepOffsets(ctx, *offsets);
+		ctx.latency.store(ctx.latencySamples);
+		setLatencySamples(ctx.latencySamples);
+	}
+
+	prepareDetector(ctx.detector, ctx.arena, sampleRate, samplesPerBlock,
+					doublePrecision);
+	setOffline(ctx, isNonRealtime());
+	prepareMidi(ctx.midi, ctx.arena);
+	endArena(ctx.arena);
+	seedStreams(ctx, ctx.seed.load());
+
+	_midiScratch.ensureSize(MidiQueueSize * 16);  // Room to drain a full queue
 	std::cout << "[*] Preparing to play" << std::endl;
 }
 
@@ -116,21 +236,90 @@ auto Processor::releaseResources() -> void {
 
 auto Processor::isBusesLayoutSupported(const BusesLayout& layouts) const
 	-> bool {
-	return true;
+	// Any main layout works as long as every input channel has an output to
+	// land on. The sidechain is only listened to, so it can be anything.
+	const auto& mainIn = layouts.getMainInputChannelSet();
+	return !mainIn.isDisabled() && mainIn == layouts.getMainOutputChannelSet();
 }
 
 auto Processor::processBlock(juce::AudioBuffer<float>& buffer,
 							 juce::MidiBuffer& midiMessages) -> void {
-	juce::ignoreUnused(midiMessages);
+	process(buffer, midiMessages);
+}
 
-	if (ctx.queuedSeedRecalc.load()) {
-		recalcRandVals();
-		ctx.queuedSeedRecalc.store(false);
-		ctx.queuedOffsetRecalc.store(true);
+auto Processor::processBlock(juce::AudioBuffer<double>& buffer,
+							 juce::MidiBuffer& midiMessages) -> void {
+	process(buffer, midiMessages);
+}
+
+// The rings and detector are prepared in whichever precision the host asked
+// for, so a 64-bit host's buffers are processed as they are
+auto Processor::supportsDoublePrecisionProcessing() const -> bool {
+	return true;
+}
+
+template <typename SampleType>
+auto Processor::process(juce::AudioBuffer<SampleType>& buffer,
+						juce::MidiBuffer& midiMessages) -> void {
+	const auto realtime = RealtimeScope{};
+
+	// Offsets are regenerated on the generator thread; we only pick up
+	// whichever table was published last
+	const auto* offsets = acquireOffsets(ctx.generator);
+	if (offsets == nullptr) {
+		return;
 	}
 
-	if (ctx.queuedOffsetRecalc.load()) {
-		applyState(ctx);
+	const auto midiMode = _midiMode->load() > 0.5f;
+	if (!midiMode) {
+		drainMidi(ctx.midi, midiMessages, buffer.getNumSamples());
+	}
+
+	// Bounces follow the detector's envelope at every sample. Hits are
+	// placed the way the knobs say in either case, so a bounce plays them
+	// where playback did.
+	if (const auto offline = isNonRealtime(); offline != ctx.offline) {
+		setOffline(ctx, offline);
+	}
+	ctx.fractional = _fractional->load() > 0.5f;
+	ctx.compensated = _compensated->load() > 0.5f;
+	if (const auto multiLane = _multiLane->load() > 0.5f;
+		multiLane != ctx.multiLane) {
+		switchLanes(ctx, multiLane);
+	}
+	updateTimeline(buffer.getNumSamples());
+	ctx.streaming = _streaming->load() > 0.5f && !ctx.timeline;
+	if (ctx.streaming) {
+		updateStreamShapes(ctx);
+	}
+
+	// Host automation only reaches us once per block, so a knob that moved is
+	// ramped to its new value over sub-blocks of AutomationStepSamples
+	const auto fromVariance = ctx.variance.load();
+	const auto fromLookahead = ctx.lookahead.load();
+	const auto fromDynamics = ctx.dynamics;
+	const auto toVariance = _variance->load();
+	const auto toLookahead = _lookahead->load();
+	const auto toDynamics = _dynamics->load();
+	if (midiMode) {
+		ctx.variance.store(toVariance);
+		ctx.lookahead.store(toLookahead);
+		ctx.dynamics = toDynamics;
+	}
+	updateStepOffsets(ctx, *offsets);
+
+	// Only changes when the sequence is regenerated or the mode is switched.
+	// The timer passes it on to the host.
+	if (ctx.latency.load(std::memory_order_relaxed) != ctx.latencySamples) {
+		ctx.latency.store(ctx.latencySamples);
+	}
+
+	// In MIDI mode the notes are humanized instead, and the audio passes
+	// straight through
+	if (midiMode) {
+		humanizeMidi(ctx, *offsets, midiMessages, _midiScratch,
+					 buffer.getNumSamples());
+		return;
 	}
 
 	const auto totalNumInputChannels = getTotalNumInputChannels();
@@ -141,73 +330,174 @@ auto Processor::processBlock(juce::AudioBuffer<float>& buffer,
 		buffer.clear(i, 0, buffer.getNumSamples());
 	}
 
-	// For each channel, get the value in the buffer at i.
-	// We have a delay buffer that we start writing at
-	for (auto channel = 0; channel < totalNumInputChannels; ++channel) {
-		const auto buffPtr = buffer.getWritePointer(channel);
-
-		for (auto i = 0; i < buffer.getNumSamples(); ++i) {
-			const auto sample = buffPtr[i];
-
-			// Check to see if we have begun playing a sound, and if so, set a
-			// flag saying so and reset our counter for the gate
-			const auto lastSampleAbs = std::fabs(ctx._lastSample.at(channel));
-			const auto sampleAbs = std::fabs(sample);
-			if (!ctx.isSoundOccurring.at(channel) && lastSampleAbs < cutoff &&
-				sampleAbs > cutoff) {
-				ctx.isSoundOccurring.at(channel) = true;
-				ctx.gateIdx.at(channel) = 0;
-
-				std::cout << "Start sound on channel " << channel << std::endl;
-			}
-
-			// If the sound is occurring, check to see if the sound has ended
-			// (which would be some amount of consecutive samples below a
-			// threshold)
-			if (ctx.isSoundOccurring.at(channel)) {
-				if (sampleAbs < cutoff) {
-					++ctx.gateIdx.at(channel);
-					if (++ctx.gateIdx.at(channel) >= attack) {
-						ctx.isSoundOccurring.at(channel) = false;
-						ctx.currDelay = (ctx.currDelay + 1) % ctx.stepsI;
-
-						std::cout << "End sound on channel " << channel
-								  << std::endl;
-					}
-				} else {
-					ctx.gateIdx.at(channel) = 0;
-				}
-			}
-
-			const auto offset = getOffsetAtI(ctx, ctx.currDelay);
-			ctx.delayBuffer.at(channel).at((ctx.delayIdx.at(channel) + offset) %
-										   delayBufferSize) += sample;
-
-			buffPtr[i] =
-				ctx.delayBuffer.at(channel).at(ctx.delayIdx.at(channel));
-			ctx.delayBuffer.at(channel).at(ctx.delayIdx.at(channel)) = 0;
-
-			ctx.delayIdx.at(channel) =
-				(ctx.delayIdx.at(channel) + 1) % delayBufferSize;
+	const auto numSamples = buffer.getNumSamples();
+	const auto automated = fromVariance != toVariance ||
+						   fromLookahead != toLookahead ||
+						   fromDynamics != toDynamics;
+	const auto step = automated ? AutomationStepSamples : numSamples;
+	const auto blockPpq = ctx.timelinePpq;
+
+	for (auto start = 0; start < numSamples; start += step) {
+		const auto n = std::min(step, numSamples - start);
+		const auto t = (float)(start + n) / (float)numSamples;
+		ctx.variance.store(fromVariance + (toVariance - fromVariance) * t);
+		ctx.lookahead.store(fromLookahead + (toLookahead - fromLookahead) * t);
+		ctx.dynamics = fromDynamics + (toDynamics - fromDynamics) * t;
+		updateStepOffsets(ctx, *offsets);
+		ctx.timelinePpq = blockPpq + start * ctx.timelinePpqPerSample;
+
+		auto subBuffer = juce::AudioBuffer<SampleType>{
+			buffer.getArrayOfWritePointers(), buffer.getNumChannels(), start,
+			n};
+		processSubBlock(subBuffer, midiMessages, start, *offsets);
+	}
+}
+
+// Everything from hit detection to the delay for `buffer`, which starts
+// `start` samples into the host's block
+template <typename SampleType>
+auto Processor::processSubBlock(juce::AudioBuffer<SampleType>& buffer,
+								const juce::MidiBuffer& midiMessages,
+								const int start,
+								const FractalNoiseResult& offsets) -> void {
+	auto mainBuffer = getBusBuffer(buffer, true, 0);
+	const auto numChannels =
+		std::min(mainBuffer.getNumChannels(), ctx.numChannels);
+	const auto numSamples = buffer.getNumSamples();
+	auto* const* channels = mainBuffer.getArrayOfWritePointers();
+
+	// Each lane listens to its own channels only
+	if (ctx.multiLane) {
+		renderLanes(ctx, offsets, channels, numChannels, numSamples);
+		return;
+	}
+
+	// Hits come from one of three places: incoming note ons, a sidechain
+	// (mono sum), or the main bus itself (loudest channel)
+	const auto midiTrigger = _midiTrigger->load() > 0.5f;
+	auto sidechainBuffer = getBusBuffer(buffer, true, 1);
+	const auto hasSidechain = !midiTrigger && getBusCount(true) > 1 &&
+							  getBus(true, 1)->isEnabled() &&
+							  sidechainBuffer.getNumChannels() > 0;
+	const auto* const* keyChannels =
+		hasSidechain ? sidechainBuffer.getArrayOfReadPointers() : channels;
+	const auto numKeyChannels =
+		hasSidechain ? sidechainBuffer.getNumChannels() : numChannels;
+	const auto keyMode = hasSidechain ? DetectorKey::Sum : DetectorKey::Loudest;
+
+	if (midiTrigger) {
+		detectMidiHits(ctx.detector, midiMessages, start, numSamples);
+	}
+
+	// Between hits there's usually nothing coming in and nothing left in the
+	// rings, so the output is the (silent) input as it is
+	const auto silent = isSilent(channels, numChannels, numSamples);
+	const auto keySilent =
+		midiTrigger ? ctx.detector.events.empty()
+		: hasSidechain ? isSilent(keyChannels, numKeyChannels, numSamples)
+					   : silent;
+	if (silent && keySilent && ctx.pendingSamples == 0 &&
+		!ctx.detector.open) {
+		if (!midiTrigger) {
+			skipDetector(ctx.detector, numSamples);
 		}
+		skipDelay(ctx, numSamples);
+		return;
 	}
+
+	if (!midiTrigger) {
+		runDetector(ctx.detector, keyChannels, numKeyChannels, numSamples,
+					keyMode);
+	}
+	buildSegments(ctx, offsets,
+				  midiTrigger ? DetectorEventType::Onset
+							  : DetectorEventType::Release);
+	renderDelay(ctx, channels, numChannels, numSamples, silent);
+}
+
+// Reads where this block of `numSamples` starts on the host's timeline. Hosts
+// that only report a sample position are treated as running at 120 bpm.
+auto Processor::updateTimeline(const int numSamples) -> void {
+	ctx.timeline = false;
+	if (_timeline->load() < 0.5f || getPlayHead() == nullptr) {
+		ctx.timelineNextPpq = -1.0;
+		return;
+	}
+
+	const auto position = getPlayHead()->getPosition();
+	if (!position.hasValue()) {
+		ctx.timelineNextPpq = -1.0;
+		return;
+	}
+
+	const auto bpm = position->getBpm().orFallback(120.0);
+	const auto sampleRate = getSampleRate();
+	ctx.timelinePpqPerSample = bpm / 60.0 / sampleRate;
+
+	if (const auto ppq = position->getPpqPosition()) {
+		ctx.timelinePpq = *ppq;
+	} else if (const auto samples = position->getTimeInSamples()) {
+		ctx.timelinePpq = (double)*samples * ctx.timelinePpqPerSample;
+	} else {
+		ctx.timelineNextPpq = -1.0;
+		return;
+	}
+	ctx.timeline = true;
+
+	// Playback starting, a jump or a loop all land somewhere other than where
+	// the last block ended. A stopped transport reports the same position
+	// block after block, which isn't a jump.
+	if (std::abs(ctx.timelinePpq - ctx.timelineNextPpq) >
+		ctx.timelinePpqPerSample) {
+		startTimeline(ctx);
+	}
+	ctx.timelineNextPpq =
+		position->getIsPlaying()
+			? ctx.timelinePpq + numSamples * ctx.timelinePpqPerSample
+			: ctx.timelinePpq;
 }
 
 auto Processor::hasEditor() const -> bool {
 	return true;
 }
 
+// Someone about to turn knobs, so start on the bank for our seed
 auto Processor::createEditor() -> juce::AudioProcessorEditor* {
+	bankReady(ctx);
 	return new Editor(*this);
 }
 
+// Every parameter is saved as it is, along with the seed
 auto Processor::getStateInformation(juce::MemoryBlock& destData) -> void {
-	serialize(destData, ctx);
+	const auto xml = params.copyState().createXml();
+	serialize(destData, ctx, *xml);
 }
 
+// The parameters are the source of truth, so a loaded state is pushed back
+// into them. States from before Version_3 only have the four knobs, and leave
+// every other parameter as it is.
 auto Processor::setStateInformation(const void* data, const int sizeInBytes)
 	-> void {
-	deserialize(data, sizeInBytes, ctx);
+	if (const auto xml = deserialize(data, sizeInBytes, ctx)) {
+		if (xml->hasTagName(params.state.getType())) {
+			params.replaceState(juce::ValueTree::fromXml(*xml));
+		}
+
+		ctx.alpha.store(_alpha->load());
+		ctx.steps.store(_steps->load());
+		ctx.variance.store(_variance->load());
+		ctx.lookahead.store(_lookahead->load());
+		ctx.dynamicsAlpha.store(_dynamicsAlpha->load());
+		applyState(ctx);
+		return;
+	}
+
+	params.getParameter("alpha")->setValueNotifyingHost(ctx.alpha.load());
+	params.getParameter("steps")->setValueNotifyingHost(ctx.steps.load());
+	params.getParameter("variance")->setValueNotifyingHost(
+		ctx.variance.load());
+	params.getParameter("lookahead")->setValueNotifyingHost(
+		ctx.lookahead.load());
 }
 
 auto JUCE_CALLTYPE createPluginFilter() -> juce::AudioProcessor* {
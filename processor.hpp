@@ -8,7 +8,7 @@
 
 #include <juce_audio_processors/juce_audio_processors.h>
 
-class Processor : public juce::AudioProcessor {
+class Processor : public juce::AudioProcessor, private juce::Timer {
    public:
 	Processor();
 	~Processor() override;
@@ -20,6 +20,9 @@ class Processor : public juce::AudioProcessor {
 
 	auto processBlock(juce::AudioBuffer<float>&, juce::MidiBuffer&)
 		-> void override;
+	auto processBlock(juce::AudioBuffer<double>&, juce::MidiBuffer&)
+		-> void override;
+	auto supportsDoublePrecisionProcessing() const -> bool override;
 	auto hasEditor() const -> bool override;
 
 	auto createEditor() -> juce::AudioProcessorEditor* override;
@@ -46,10 +49,36 @@ class Processor : public juce::AudioProcessor {
 	bool hasSetStateInfo = false;
 
    private:
+	template <typename SampleType>
+	auto process(juce::AudioBuffer<SampleType>& buffer,
+				 juce::MidiBuffer& midiMessages) -> void;
+	template <typename SampleType>
+	auto processSubBlock(juce::AudioBuffer<SampleType>& buffer,
+						 const juce::MidiBuffer& midiMessages,
+						 int start,
+						 const FractalNoiseResult& offsets) -> void;
+	auto updateTimeline(int numSamples) -> void;
+	auto timerCallback() -> void override;
+
 	juce::AudioProcessorValueTreeState params;
 	JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(Processor)
 
-	juce::AudioBuffer<float> _delayBuffer;
+	std::atomic<float>* _alpha = nullptr;
+	std::atomic<float>* _steps = nullptr;
+	std::atomic<float>* _variance = nullptr;
+	std::atomic<float>* _lookahead = nullptr;
+	std::atomic<float>* _fractional = nullptr;
+	std::atomic<float>* _compensated = nullptr;
+	std::atomic<float>* _midiMode = nullptr;
+	std::atomic<float>* _midiTrigger = nullptr;
+	std::atomic<float>* _multiLane = nullptr;
+	std::atomic<float>* _timeline = nullptr;
+	std::atomic<float>* _dynamics = nullptr;
+	std::atomic<float>* _dynamicsAlpha = nullptr;
+	std::atomic<float>* _streaming = nullptr;
+
+	juce::MidiBuffer _midiScratch;
+
 	int _offset = 0;
 	int _difference = 1;
 	// int _writeOffset = 0;
@@ -2,8 +2,1124 @@
 // Created by James Pickering on 7/24/25.
 //
 
+#include "../lib/bank.hpp"
+#include "../lib/delay.hpp"
+#include "../lib/detector.hpp"
 #include "../lib/engine.hpp"
+#include "../lib/fft.hpp"
+#include "../lib/lanes.hpp"
+#include "../lib/midi.hpp"
+#include "../lib/random.hpp"
+#include "../lib/realtime.hpp"
+#include "../lib/sequences.hpp"
+
+#include <juce_audio_basics/juce_audio_basics.h>
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <complex>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <valarray>
+#include <vector>
+
+// How State was laid out before it was split: the knobs the audio thread
+// follows right next to the counters it bumps every sample
+struct PackedState {
+	std::atomic<float> variance = 0.5f;
+	std::atomic<float> lookahead = 0.0f;
+	int delayIdx = 0;
+	int currDelay = -1;
+};
+
+// Times the audio thread's counters and its stores to the knobs it follows,
+// while another thread reads those knobs as fast as it can, which is an
+// editor redrawing on every frame at worst. The editor stores nothing to the
+// state; every read it makes still pulls the line away from the audio thread
+// when the two share one.
+template <typename S>
+auto benchFalseSharing(S& state) -> double {
+	constexpr auto Iterations = 50'000'000;
+
+	auto running = std::atomic<bool>{true};
+	auto seen = std::atomic<float>{0.f};
+	auto editor = std::thread{[&state, &running, &seen] {
+		auto sum = 0.f;
+		while (running.load(std::memory_order_relaxed)) {
+			sum += state.variance.load(std::memory_order_relaxed) +
+				   state.lookahead.load(std::memory_order_relaxed);
+		}
+		seen.store(sum);
+	}};
+
+	auto delayIdx = std::atomic_ref{state.delayIdx};
+	auto currDelay = std::atomic_ref{state.currDelay};
+
+	const auto start = std::chrono::steady_clock::now();
+	for (auto i = 0; i < Iterations; ++i) {
+		const auto idx = (delayIdx.load(std::memory_order_relaxed) + 1) & 16383;
+		delayIdx.store(idx, std::memory_order_relaxed);
+		if ((idx & 255) == 0) {
+			currDelay.store((currDelay.load(std::memory_order_relaxed) + 1) %
+								MaxSteps,
+							std::memory_order_relaxed);
+			// A block's worth of samples: follow the knobs like process does
+			state.variance.store((float)idx, std::memory_order_relaxed);
+			state.lookahead.store((float)idx, std::memory_order_relaxed);
+		}
+	}
+	const auto elapsed = std::chrono::steady_clock::now() - start;
+
+	running.store(false);
+	editor.join();
+
+	return std::chrono::duration<double, std::nano>(elapsed).count() /
+		   Iterations;
+}
+
+// How genFractalOffsets used to get from a spectrum to a sequence: the full
+// spectrum rebuilt from its first half, then a recursive radix 2 transform
+// that copies both halves at every level
+using c_val_array = std::valarray<std::complex<float>>;
+
+auto recursiveFft(c_val_array& x) -> void {
+	const auto n = x.size();
+	if (n <= 1) {
+		return;
+	}
+
+	auto even = c_val_array{x[std::slice(0, n / 2, 2)]};
+	auto odd = c_val_array{x[std::slice(1, n / 2, 2)]};
+	recursiveFft(even);
+	recursiveFft(odd);
+
+	for (auto k = std::size_t{0}; k < n / 2; ++k) {
+		const auto t = std::polar<float>(1.0, -2.0 * M_PI * k / n) * odd[k];
+		x[k] = even[k] + t;
+		x[k + n / 2] = even[k] - t;
+	}
+}
+
+auto recursiveInverse(const std::vector<std::complex<float>>& bins)
+	-> c_val_array {
+	const auto numBins = bins.size();
+	auto full = c_val_array(numBins * 2 - 2);
+	for (auto i = std::size_t{0}; i < numBins; ++i) {
+		full[i] = bins[i];
+	}
+	for (auto i = std::size_t{1}; i < numBins - 1; ++i) {
+		full[numBins - 1 + i] = std::conj(bins[numBins - 1 - i]);
+	}
+
+	full = full.apply(std::conj);
+	recursiveFft(full);
+	full = full.apply(std::conj);
+	full /= full.size();
+	return full;
+}
+
+auto randomBins(const int size) -> std::vector<std::complex<float>> {
+	auto bins = std::vector<std::complex<float>>{};
+	for (auto i = 0; i <= size / 2; ++i) {
+		bins.push_back(std::polar(1.f / (float)(i + 1), (float)i * 2.4f));
+	}
+	return bins;
+}
+
+// Largest difference between inverseRealFft and the inverse DFT written out,
+// over every sequence length genFractalOffsets can ask for
+auto checkRealFft() -> double {
+	auto worst = 0.0;
+	for (auto size = MinSteps; size <= MaxSteps; size += 2) {
+		const auto bins = randomBins(size);
+		const auto& plan = realFftPlan(size);
+		auto scratch =
+			std::vector<std::complex<float>>(realFftScratchSize(plan));
+		auto out = std::vector<float>(size);
+		inverseRealFft(plan, bins.data(), out.data(), scratch.data());
+
+		for (auto n = 0; n < size; ++n) {
+			auto expected = 0.0;
+			for (auto k = 0; k < size; ++k) {
+				auto bin = std::complex<double>{
+					k <= size / 2 ? bins[k] : std::conj(bins[size - k])};
+				if (k == 0 || k == size / 2) {
+					bin.imag(0.0);
+				}
+				expected += std::real(
+					bin * std::polar(1.0, 2.0 * M_PI * n * k / size));
+			}
+			worst = std::max(worst, std::abs(expected / size - out[n]));
+		}
+	}
+	return worst;
+}
+
+// Times both ways of turning a half spectrum into a sequence of `size`
+template <typename Fn>
+auto benchTransform(const int size, Fn&& fn) -> double {
+	constexpr auto Iterations = 20'000;
+
+	const auto bins = randomBins(size);
+	auto sink = 0.f;
+	const auto start = std::chrono::steady_clock::now();
+	for (auto i = 0; i < Iterations; ++i) {
+		sink += fn(bins);
+	}
+	const auto elapsed = std::chrono::steady_clock::now() - start;
+
+	if (sink == 1234.5f) {
+		std::cout << sink;
+	}
+	return std::chrono::duration<double, std::nano>(elapsed).count() /
+		   Iterations;
+}
+
+auto benchFft() -> void {
+	for (auto size = MinSteps; size <= MaxSteps; size += 2) {
+		const auto recursive = benchTransform(size, [](const auto& bins) {
+			return recursiveInverse(bins)[0].real();
+		});
+
+		const auto& plan = realFftPlan(size);
+		auto scratch =
+			std::vector<std::complex<float>>(realFftScratchSize(plan));
+		auto out = std::vector<float>(size);
+		const auto planned = benchTransform(size, [&](const auto& bins) {
+			inverseRealFft(plan, bins.data(), out.data(), scratch.data());
+			return out[0];
+		});
+
+		std::cout << "fft " << size << ": recursive " << recursive
+				  << " ns, planned " << planned << " ns" << std::endl;
+	}
+}
+
+// Standard deviation of `values` about zero
+auto deviation(const std::vector<float>& values) -> double {
+	auto variance = 0.0;
+	for (const auto val : values) {
+		variance += val * val;
+	}
+	return std::sqrt(variance / values.size());
+}
+
+// The largest relative difference between the deviation genFractalOffsets
+// was asked for and the one its sequences have, over every step count and
+// across the alpha knob
+auto checkOffsetDeviation() -> double {
+	auto worst = 0.0;
+	for (auto steps = MinSteps; steps <= MaxSteps; ++steps) {
+		for (auto knob = 0; knob <= 10; ++knob) {
+			const auto alpha = (float)knob / 10.f * 0.3f + 0.5f;
+			const auto offsets =
+				genFractalOffsets(steps, alpha, OffsetStd, 9, knob);
+			worst = std::max(
+				worst, std::abs(deviation(offsets.offsets) / OffsetStd - 1.0));
+		}
+	}
+	return worst;
+}
+
+// The largest relative difference between a unit deviation and that of any
+// lane's gains, across the steps and dynamics alpha knobs. At full dynamics a
+// gain one deviation up has to come out MaxDynamicsDb louder.
+auto checkGainDeviation() -> double {
+	auto worst = std::abs(20.0 * std::log10(gainAt(1.f, 1.f)) / MaxDynamicsDb -
+						  1.0);
+	for (auto knob = 0; knob <= 4; ++knob) {
+		auto state = std::make_unique<State>();
+		state->steps.store((float)knob / 4.f);
+		state->dynamicsAlpha.store((float)knob / 4.f);
+		applyState(*state);
+
+		for (const auto& gains : latestOffsets(state->generator)->laneGains) {
+			worst = std::max(worst, std::abs(deviation(gains) - 1.0));
+		}
+	}
+	return worst;
+}
+
+// Streaming mode has to spread hits as far as the tables do at the same
+// knobs, for both offsets and gains. Returns the largest relative difference
+// between the two modes' deviations across the alpha knobs.
+auto checkStreamDeviation() -> double {
+	constexpr auto Hits = 1 << 16;
+
+	auto worst = 0.0;
+	for (auto knob = 0; knob <= 4; ++knob) {
+		auto state = std::make_unique<State>();
+		state->alpha.store((float)knob / 4.f);
+		state->dynamicsAlpha.store((float)knob / 4.f);
+		applyState(*state);
+		const auto table = latestOffsets(state->generator);
+
+		updateStreamShapes(*state);
+		auto offsets = std::vector<float>(Hits);
+		auto gains = std::vector<float>(Hits);
+		for (auto hit = 0; hit < Hits; ++hit) {
+			advanceStream(*state, 0);
+			offsets[hit] = state->streams[0].offsets.value * OffsetStd;
+			gains[hit] = state->streams[0].gains.value;
+		}
+
+		const auto& tableGains = table->laneGains[0];
+		const auto offsetRatio = deviation(offsets) / deviation(table->offsets);
+		const auto gainRatio = deviation(gains) / deviation(tableGains);
+		worst = std::max({worst, std::abs(offsetRatio - 1.0),
+						  std::abs(gainRatio - 1.0)});
+	}
+	return worst;
+}
+
+// Loads the same settings into a session's worth of instances from several
+// threads at once, the way a host restores a template. Returns how many
+// sequences that generated, which should be one.
+auto checkSequenceSharing() -> std::size_t {
+	constexpr auto Instances = 64;
+	constexpr auto Threads = 8;
+
+	auto states = std::vector<std::unique_ptr<State>>{};
+	for (auto i = 0; i < Instances; ++i) {
+		states.push_back(std::make_unique<State>());
+		states.back()->alpha.store(0.123f);
+		states.back()->steps.store(0.77f);
+	}
+
+	auto& cache = sequenceCache();
+	const auto misses = cache.misses;
+
+	auto loaders = std::vector<std::thread>{};
+	for (auto t = 0; t < Threads; ++t) {
+		loaders.emplace_back([&states, t] {
+			for (auto i = t; i < Instances; i += Threads) {
+				applyState(*states[i]);
+			}
+		});
+	}
+	for (auto& loader : loaders) {
+		loader.join();
+	}
+
+	const auto first = latestOffsets(states[0]->generator);
+	for (const auto& state : states) {
+		if (latestOffsets(state->generator) != first) {
+			return Instances;
+		}
+	}
+	return cache.misses - misses;
+}
+
+// A session's worth of instances all asking for new tables at once, served
+// by the shared workers. Every one has to end up with the table for its own
+// knobs. Then a build that started before a state load finishes after it,
+// and mustn't replace what the load published.
+auto checkGeneratorPool() -> bool {
+	constexpr auto Instances = 300;
+
+	auto states = std::vector<std::unique_ptr<State>>{};
+	for (auto i = 0; i < Instances; ++i) {
+		auto& state = *states.emplace_back(std::make_unique<State>());
+		state.steps.store((float)(i % 21) / 20.f);
+		state.alpha.store((float)(i % 7) / 6.f);
+		startGenerator(state);
+		requestOffsets(state.generator);
+	}
+
+	const auto deadline =
+		std::chrono::steady_clock::now() + std::chrono::seconds{60};
+	for (const auto& state : states) {
+		const auto steps = stepsFromKnobValue(state->steps);
+		while (true) {
+			const auto table = latestOffsets(state->generator);
+			if (table && table->steps == steps) {
+				break;
+			}
+			if (std::chrono::steady_clock::now() > deadline) {
+				return false;
+			}
+			std::this_thread::sleep_for(std::chrono::milliseconds{1});
+		}
+	}
+
+	auto& gen = states[0]->generator;
+	const auto stale = beginGeneration(gen);
+	const auto before = latestOffsets(gen);
+	states[0]->steps.store(1.f);
+	applyState(*states[0]);
+	const auto loaded = latestOffsets(gen);
+	return !publishOffsets(gen, before, stale) &&
+		   latestOffsets(gen) == loaded && loaded->steps == MaxSteps;
+}
+
+// A State with its rings, detectors and MIDI queue prepared the way
+// prepareToPlay does it
+auto preparedState(const int numChannels,
+				   const int maxBlockSize,
+				   const bool doublePrecision = false)
+	-> std::unique_ptr<State> {
+	auto state = std::make_unique<State>();
+	beginArena(state->arena);
+	prepareDelay(*state, ReferenceSampleRate, numChannels, maxBlockSize,
+				 doublePrecision);
+	prepareLanes(*state, ReferenceSampleRate, maxBlockSize, doublePrecision);
+	prepareDetector(state->detector, state->arena, ReferenceSampleRate,
+					maxBlockSize, doublePrecision);
+	prepareMidi(state->midi, state->arena);
+	endArena(state->arena);
+	return state;
+}
+
+// Uniform in [lo, hi]
+auto randomInt(std::uint64_t& rng, const int lo, const int hi) -> int {
+	return lo + (int)(splitMix(rng) % (std::uint64_t)(hi - lo + 1));
+}
+
+// Runs random hits through the segmented kernel, in random block sizes with a
+// random number of segments each, and through a delay line written out a
+// sample at a time. Returns the largest difference between the two, which
+// for the integer path should be none at all.
+auto checkDelayKernel(const bool fractional) -> float {
+	constexpr auto Runs = 200;
+	constexpr auto NumChannels = 2;
+	constexpr auto MaxBlock = 512;
+	constexpr auto Length = 4096;
+
+	auto rng = std::uint64_t{fractional ? 2u : 1u};
+	auto worst = 0.f;
+	for (auto run = 0; run < Runs; ++run) {
+		auto state = preparedState(NumChannels, MaxBlock);
+		state->fractional = fractional;
+		const auto maxOffset = std::min(3000, state->ringSize - FracTaps - 1);
+		const auto total = Length + maxOffset + FracTaps + 1;
+
+		auto input = std::vector<std::vector<float>>(NumChannels);
+		auto expected = std::vector<std::vector<float>>(NumChannels);
+		auto output = std::vector<std::vector<float>>(NumChannels);
+		for (auto channel = 0; channel < NumChannels; ++channel) {
+			input[channel] = std::vector<float>(total);
+			for (auto i = 0; i < Length; ++i) {
+				input[channel][i] = unitFloat(splitMix(rng)) * 2.f - 1.f;
+			}
+			expected[channel] = std::vector<float>(total + maxOffset + 1);
+			output[channel] = input[channel];
+		}
+
+		for (auto start = 0; start < total;) {
+			const auto n = std::min(randomInt(rng, 1, MaxBlock), total - start);
+
+			auto segments = std::vector<HitSegment>{};
+			segments.push_back({});
+			for (auto i = randomInt(rng, 0, 4); i > 0 && n > 1; --i) {
+				const auto pos = randomInt(rng, 1, n - 1);
+				if (pos > segments.back().start) {
+					segments.push_back({pos});
+				}
+			}
+			for (auto& segment : segments) {
+				segment.offset = randomInt(rng, 0, maxOffset);
+				segment.phase = fractional ? randomInt(rng, 0, FracPhases - 1)
+										   : 0;
+				segment.gain = randomInt(rng, 0, 1) == 0
+								   ? 1.f
+								   : unitFloat(splitMix(rng)) * 2.f;
+			}
+
+			// The reference, one input sample at a time
+			for (auto s = 0; s < (int)segments.size(); ++s) {
+				const auto& segment = segments[s];
+				const auto end =
+					s + 1 < (int)segments.size() ? segments[s + 1].start : n;
+				const auto* const taps =
+					state->fracTable.data() + segment.phase * FracTaps;
+				for (auto i = segment.start; i < end; ++i) {
+					const auto t = start + i;
+					for (auto channel = 0; channel < NumChannels; ++channel) {
+						auto* const out = expected[channel].data() + t;
+						const auto x = input[channel][t];
+						if (!fractional) {
+							out[segment.offset] += x * segment.gain;
+							continue;
+						}
+						for (auto k = 0; k < FracTaps; ++k) {
+							out[segment.offset + 1 + k] +=
+								x * (taps[k] * segment.gain);
+						}
+					}
+				}
+			}
+
+			auto channels = std::array<float*, NumChannels>{};
+			for (auto channel = 0; channel < NumChannels; ++channel) {
+				channels[channel] = output[channel].data() + start;
+			}
+			renderSegments(*state, segments.data(), (int)segments.size(),
+						   channels.data(), 0, NumChannels, n, false,
+						   state->pendingSamples);
+			skipDelay(*state, n);
+			start += n;
+		}
+
+		for (auto channel = 0; channel < NumChannels; ++channel) {
+			for (auto i = 0; i < total; ++i) {
+				worst = std::max(
+					worst, std::abs(output[channel][i] - expected[channel][i]));
+			}
+		}
+	}
+	return worst;
+}
+
+// Places hits at random offsets in compensated mode and renders an impulse
+// through them. The integer path has to put it on the offset rounded, and the
+// fractional taps have to centre it on the offset itself, so either tier
+// plays a hit at the same time. Returns the furthest the fractional centre
+// landed from the offset.
+auto checkHitPlacement() -> float {
+	constexpr auto Hits = 100;
+	constexpr auto Length = 1024;
+
+	auto rng = std::uint64_t{6};
+	auto worst = 0.f;
+	for (auto hit = 0; hit < Hits; ++hit) {
+		const auto offset = unitFloat(splitMix(rng)) * 500.f - 20.f;
+		for (const auto fractional : {false, true}) {
+			auto state = preparedState(1, Length);
+			state->fractional = fractional;
+			state->latencySamples = 20 + FracTaps / 2;
+			const auto segment = placeHit(*state, 0, offset, 1.f);
+
+			auto impulse = std::vector<float>(Length);
+			impulse[0] = 1.f;
+			float* channels[] = {impulse.data()};
+			renderSegments(*state, &segment, 1, channels, 0, 1, Length, false,
+						   state->pendingSamples);
+
+			const auto expected = offset + (float)state->latencySamples;
+			if (!fractional) {
+				const auto peak = std::ranges::max_element(impulse);
+				if (peak - impulse.begin() != std::lround(expected)) {
+					return Length;
+				}
+				continue;
+			}
+
+			auto sum = 0.f;
+			auto moment = 0.f;
+			for (auto i = 0; i < Length; ++i) {
+				sum += impulse[i];
+				moment += impulse[i] * (float)i;
+			}
+			worst = std::max(worst, std::abs(moment / sum - expected));
+		}
+	}
+	return worst;
+}
+
+// Renders an impulse through a hit at every fractional phase and measures
+// the magnitude response of what comes out. Returns the furthest any phase
+// strays from unity, in dB, up to `maxHz` at ReferenceSampleRate. The taps
+// are short, so they only hold flat over the lower part of the band.
+auto checkFracResponse(const float maxHz) -> float {
+	constexpr auto Length = 256;
+	constexpr auto Bins = 64;
+
+	auto worst = 0.f;
+	for (auto phase = 0; phase < FracPhases; ++phase) {
+		auto state = preparedState(1, Length);
+		state->fractional = true;
+		const auto offset = 100.f + (float)phase / FracPhases;
+		const auto segment = placeHit(*state, 0, offset, 1.f);
+
+		auto impulse = std::vector<float>(Length);
+		impulse[0] = 1.f;
+		float* channels[] = {impulse.data()};
+		renderSegments(*state, &segment, 1, channels, 0, 1, Length, false,
+					   state->pendingSamples);
+
+		for (auto bin = 0; bin <= Bins; ++bin) {
+			const auto hz = maxHz * (float)bin / Bins;
+			const auto w = 2.0 * M_PI * hz / ReferenceSampleRate;
+			auto response = std::complex<double>{};
+			for (auto i = 0; i < Length; ++i) {
+				response += (double)impulse[i] * std::polar(1.0, -w * i);
+			}
+			const auto db = 20.0 * std::log10(std::abs(response));
+			worst = std::max(worst, (float)std::abs(db));
+		}
+	}
+	return worst;
+}
+
+// Decaying bursts every BurstSpacing samples over a noise floor `noise` loud.
+// The first BurstWarmup samples are noise alone, which is long enough for a
+// detector to learn the floor.
+constexpr auto BurstSpacing = 8000;
+constexpr auto BurstLength = 2000;
+constexpr auto BurstWarmup = 2 * (int)ReferenceSampleRate;
+
+auto burstSignal(const int bursts, const float noise, std::uint64_t rng)
+	-> std::vector<float> {
+	auto signal = std::vector<float>(BurstWarmup + bursts * BurstSpacing);
+	for (auto i = BurstWarmup; i < (int)signal.size(); ++i) {
+		const auto pos = (i - BurstWarmup) % BurstSpacing;
+		if (pos < BurstLength) {
+			const auto decay = std::exp(-(float)pos / 220.f);
+			signal[i] = 0.5f * decay * std::sin(0.3f * (float)pos + 1.f);
+		}
+	}
+	for (auto& sample : signal) {
+		sample += (unitFloat(splitMix(rng)) * 2.f - 1.f) * noise;
+	}
+	return signal;
+}
+
+// Feeds the bursts through the detector in uneven blocks. Once it has settled,
+// every burst should give one onset within a millisecond of where it starts
+// and one release before the next burst, and nothing else.
+auto checkDetector(const bool exact) -> bool {
+	constexpr auto Bursts = 10;
+	constexpr auto MaxBlock = 512;
+
+	auto state = preparedState(1, MaxBlock);
+	auto& det = state->detector;
+	det.exact = exact;
+	auto signal = burstSignal(Bursts, 1e-3f, 3);
+
+	auto events = std::vector<DetectorEvent>{};
+	auto rng = std::uint64_t{4};
+	for (auto start = 0; start < (int)signal.size();) {
+		const auto n =
+			std::min(randomInt(rng, 1, MaxBlock), (int)signal.size() - start);
+		const float* channels[] = {signal.data() + start};
+		runDetector(det, channels, 1, n);
+		for (const auto event : det.events) {
+			if (start + event.pos >= BurstWarmup) {
+				events.push_back({start + event.pos, event.type});
+			}
+		}
+		start += n;
+	}
+
+	if (events.size() != Bursts * 2) {
+		return false;
+	}
+	for (auto burst = 0; burst < Bursts; ++burst) {
+		const auto onset = BurstWarmup + burst * BurstSpacing;
+		const auto& open = events[burst * 2];
+		const auto& close = events[burst * 2 + 1];
+		if (open.type != DetectorEventType::Onset ||
+			std::abs(open.pos - onset) > (int)(ReferenceSampleRate / 1000) ||
+			close.type != DetectorEventType::Release || close.pos <= onset ||
+			close.pos >= onset + BurstSpacing) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// Renders the bursts in timeline mode from `from` to the end, in blocks, the
+// way a host renders a song or a selection of it
+auto renderTimeline(const std::vector<float>& signal, const int from)
+	-> std::vector<float> {
+	constexpr auto BlockSize = 256;
+
+	auto state = preparedState(1, BlockSize);
+	applyState(*state);
+	const auto* offsets = acquireOffsets(state->generator);
+	updateStepOffsets(*state, *offsets);
+	state->timeline = true;
+	state->timelinePpqPerSample = 2.0 / ReferenceSampleRate;
+	startTimeline(*state);
+
+	auto output = std::vector<float>(signal.begin() + from, signal.end());
+	for (auto start = 0; start < (int)output.size(); start += BlockSize) {
+		const auto n = std::min(BlockSize, (int)output.size() - start);
+		state->timelinePpq = (from + start) * state->timelinePpqPerSample;
+
+		float* channels[] = {output.data() + start};
+		runDetector(state->detector, channels, 1, n);
+		buildSegments(*state, *offsets, DetectorEventType::Release);
+		renderDelay(*state, channels, 1, n, false);
+	}
+	return output;
+}
+
+// A render that starts between two hits has to come out the same, sample for
+// sample, as the same stretch of a render of the whole thing. Over a noise
+// floor the detector has to learn the floor again from the new start, and the
+// noise before the first hit went through a different step's delay than in
+// the whole render, so there it only has to match once that has played out.
+auto checkTimelineChunks(const float noise) -> bool {
+	constexpr auto Bursts = 8;
+
+	const auto signal = burstSignal(Bursts, noise, 7);
+	const auto from = BurstWarmup + 3 * BurstSpacing + BurstSpacing / 2 + 123;
+	const auto whole = renderTimeline(signal, 0);
+	const auto chunk = renderTimeline(signal, from);
+	const auto settled =
+		noise == 0.f ? 0
+					 : BurstWarmup + 4 * BurstSpacing - from +
+						   maxOffsetSamples(ReferenceSampleRate);
+	return std::equal(chunk.begin() + settled, chunk.end(),
+					  whole.begin() + from + settled);
+}
+
+// Bursts on the second lane's channels only. The first lane must stay where
+// it started and silent, and the second must move a step per burst.
+auto checkLanes() -> bool {
+	constexpr auto Bursts = 6;
+	constexpr auto NumChannels = 2 * LaneWidth;
+	constexpr auto BlockSize = 256;
+
+	auto state = preparedState(NumChannels, BlockSize);
+	applyState(*state);
+	const auto* offsets = acquireOffsets(state->generator);
+	switchLanes(*state, true);
+	updateStepOffsets(*state, *offsets);
+
+	const auto signal = burstSignal(Bursts, 0.f, 5);
+	auto block = std::vector<std::vector<float>>(
+		NumChannels, std::vector<float>(BlockSize));
+	auto firstLaneSilent = true;
+	for (auto start = 0; start + BlockSize <= (int)signal.size();
+		 start += BlockSize) {
+		auto channels = std::array<float*, NumChannels>{};
+		for (auto channel = 0; channel < NumChannels; ++channel) {
+			auto& samples = block[channel];
+			if (channel < LaneWidth) {
+				std::ranges::fill(samples, 0.f);
+			} else {
+				std::copy_n(signal.data() + start, BlockSize, samples.data());
+			}
+			channels[channel] = samples.data();
+		}
+		renderLanes(*state, *offsets, channels.data(), NumChannels, BlockSize);
+		for (auto channel = 0; channel < LaneWidth; ++channel) {
+			firstLaneSilent = firstLaneSilent &&
+							  std::ranges::all_of(block[channel], [](auto x) {
+								  return x == 0.f;
+							  });
+		}
+	}
+
+	return firstLaneSilent && state->lanes.currDelay[0] == -1 &&
+		   state->lanes.currDelay[1] == (Bursts - 1) % offsets->steps;
+}
+
+// Plays a note every NoteSpacing samples through MIDI mode, a block at a time.
+// Each note on has to come out shifted by the next step's offset, with its
+// note off shifted by the same amount and nothing lost or added.
+auto checkMidi() -> bool {
+	constexpr auto Notes = 40;
+	constexpr auto NoteSpacing = 1000;
+	constexpr auto NoteLength = 300;
+	constexpr auto BlockSize = 256;
+
+	// No variance, so no note is pushed past the next one
+	auto state = preparedState(2, BlockSize);
+	applyState(*state);
+	const auto* offsets = acquireOffsets(state->generator);
+	state->variance.store(0.f);
+	updateStepOffsets(*state, *offsets);
+
+	auto midi = juce::MidiBuffer{};
+	auto scratch = juce::MidiBuffer{};
+	auto ons = std::vector<std::int64_t>{};
+	auto offs = std::vector<std::int64_t>{};
+	const auto length = Notes * NoteSpacing + state->ringSize;
+	for (auto start = 0; start < length; start += BlockSize) {
+		midi.clear();
+		for (auto i = 0; i < BlockSize; ++i) {
+			const auto t = start + i;
+			if (t >= Notes * NoteSpacing) {
+				break;
+			}
+			if (t % NoteSpacing == 0) {
+				midi.addEvent(
+					juce::MidiMessage::noteOn(1, 60, (juce::uint8)100), i);
+			} else if (t % NoteSpacing == NoteLength) {
+				midi.addEvent(juce::MidiMessage::noteOff(1, 60), i);
+			}
+		}
+
+		humanizeMidi(*state, *offsets, midi, scratch, BlockSize);
+		for (const auto metadata : midi) {
+			const auto message = metadata.getMessage();
+			auto& times = message.isNoteOn() ? ons : offs;
+			times.push_back(start + metadata.samplePosition);
+		}
+	}
+
+	if (ons.size() != Notes || offs.size() != Notes) {
+		return false;
+	}
+	for (auto note = 0; note < Notes; ++note) {
+		const auto offset = std::max(
+			state->stepOffsets[note % offsets->steps], std::int32_t{0});
+		if (ons[note] != note * NoteSpacing + offset ||
+			offs[note] != ons[note] + NoteLength) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// The largest offset any step of any lane reaches, in either latency mode and
+// tier, at the knob settings that push hits furthest, as a fraction of what
+// maxOffsetSamples sizes the rings for. Anything over 1 would wrap the ring.
+auto checkOffsetBound() -> float {
+	auto state = preparedState(2, 256);
+	state->multiLane = true;
+	state->variance.store(1.f);
+
+	auto worst = 0;
+	for (auto knob = 0; knob <= 10; ++knob) {
+		state->alpha.store((float)knob / 10.f);
+		state->steps.store((float)knob / 10.f);
+		state->seed.store(knob);
+		applyState(*state);
+		const auto* offsets = acquireOffsets(state->generator);
+
+		for (const auto flags : {0, 1, 2, 3}) {
+			state->compensated = (flags & 1) != 0;
+			state->fractional = (flags & 2) != 0;
+			for (const auto lookahead : {0.f, 1.f}) {
+				state->lookahead.store(lookahead);
+				updateStepOffsets(*state, *offsets);
+				for (auto i = 0; i < MaxLanes * MaxSteps; ++i) {
+					worst = std::max(worst, state->stepOffsets[i] +
+												(state->fractional
+													 ? FracTaps / 2 + 1
+													 : 0));
+				}
+			}
+		}
+	}
+	return (float)worst / (float)maxOffsetSamples(ReferenceSampleRate);
+}
+
+// Once the parameter bank for a seed is built, the table an instance plays
+// has to still be the one straight from the FFT, so a session sounds the same
+// whether or not the bank was ready when it loaded
+auto checkBankIsPreviewOnly() -> bool {
+	auto state = std::make_unique<State>();
+	state->seed.store(1234);
+	state->alpha.store(0.37f);
+	while (!bankReady(*state)) {
+		std::this_thread::sleep_for(std::chrono::milliseconds{1});
+	}
+
+	previewState(*state);
+	const auto preview = latestOffsets(state->generator);
+	applyState(*state);
+	const auto played = latestOffsets(state->generator);
+
+	const auto exact = genFractalOffsets(
+		played->steps, alphaFromKey(quantizeAlpha(0.37f)) * 0.3f + 0.5f,
+		OffsetStd, 1234);
+	return preview != played && played->offsets == exact.offsets;
+}
+
+// Lets the first bank through once released, and counts every sequence made
+// for each seed
+auto bankRelease = std::atomic<bool>{false};
+auto bankSequences = std::array<std::atomic<int>, 4>{};
+
+auto countedSequence(const SequenceKey& key) -> FractalNoiseResult {
+	while (key.seed == 1 && !bankRelease.load()) {
+		std::this_thread::yield();
+	}
+	bankSequences[key.seed].fetch_add(1);
+	auto res = FractalNoiseResult{};
+	res.steps = key.steps;
+	return res;
+}
+
+// Asks for three seeds while the first is still building. The first has to
+// finish rather than restart, the second is replaced in the queue by the
+// third, and none of it blocks the caller.
+auto checkBankQueue() -> bool {
+	constexpr auto BankSize = (MaxSteps - MinSteps + 1) * BankAlphaPoints;
+
+	auto builder = BankBuilder{};
+	if (acquireBank(builder, 1, countedSequence) != nullptr) {
+		return false;
+	}
+
+	// Once the first build is running, the rest find it there
+	auto started = false;
+	while (!started) {
+		const auto lock = std::lock_guard{builder.mutex};
+		started = builder.building;
+	}
+	for (const auto seed : {2, 3}) {
+		if (acquireBank(builder, seed, countedSequence) != nullptr) {
+			return false;
+		}
+	}
+	bankRelease.store(true);
+
+	const auto deadline =
+		std::chrono::steady_clock::now() + std::chrono::seconds{10};
+	while (!acquireBank(builder, 3, countedSequence)) {
+		if (std::chrono::steady_clock::now() > deadline) {
+			return false;
+		}
+		std::this_thread::sleep_for(std::chrono::milliseconds{1});
+	}
+	return bankSequences[1] == BankSize && bankSequences[2] == 0 &&
+		   bankSequences[3] == BankSize;
+}
+
+// Runs blocks of bursts through every kernel processBlock can reach, the way
+// it does, in every combination of the modes: bit 0 streaming, 1 fractional,
+// 2 compensated, 3 timeline, 4 multi-lane, 5 MIDI, 6 offline, 7 MIDI
+// triggered, 8 sidechain. Modes switch between blocks like a host automating
+// them would.
+template <typename SampleType>
+auto renderEveryMode(State& state,
+					 const std::vector<float>& signal,
+					 juce::MidiBuffer& midi,
+					 juce::MidiBuffer& scratch) -> void {
+	constexpr auto NumModes = 1 << 9;
+	constexpr auto BlocksPerMode = 8;
+	constexpr auto BlockSize = 256;
+	constexpr auto NumChannels = 2 * LaneWidth;
+
+	auto block = std::array<std::array<SampleType, BlockSize>, NumChannels>{};
+	auto channels = std::array<SampleType*, NumChannels>{};
+	for (auto channel = 0; channel < NumChannels; ++channel) {
+		channels[channel] = block[channel].data();
+	}
+
+	auto pos = 0;
+	for (auto mode = 0; mode < NumModes; ++mode) {
+		const auto has = [mode](const int bit) {
+			return (mode >> bit & 1) != 0;
+		};
+		for (auto b = 0; b < BlocksPerMode; ++b, pos += BlockSize) {
+			const auto* offsets = acquireOffsets(state.generator);
+			for (auto& samples : block) {
+				for (auto i = 0; i < BlockSize; ++i) {
+					samples[i] =
+						(SampleType)signal[(pos + i) % (int)signal.size()];
+				}
+			}
+			midi.clear();
+			midi.addEvent(juce::MidiMessage::noteOn(1, 60, (juce::uint8)100),
+						  b * 16);
+			midi.addEvent(juce::MidiMessage::noteOff(1, 60), b * 16 + 8);
+
+			if (!has(5)) {
+				drainMidi(state.midi, midi, BlockSize);
+			}
+			if (has(6) != state.offline) {
+				setOffline(state, has(6));
+			}
+			state.fractional = has(1);
+			state.compensated = has(2);
+			if (has(4) != state.multiLane) {
+				switchLanes(state, has(4));
+			}
+			state.timeline = has(3);
+			state.timelinePpqPerSample = 2.0 / ReferenceSampleRate;
+			state.timelinePpq = pos * state.timelinePpqPerSample;
+			if (state.timeline && b == 0) {
+				startTimeline(state);
+			}
+			state.streaming = has(0) && !state.timeline;
+			if (state.streaming) {
+				updateStreamShapes(state);
+			}
+			state.variance.store((float)b / BlocksPerMode);
+			updateStepOffsets(state, *offsets);
+
+			if (has(5)) {
+				humanizeMidi(state, *offsets, midi, scratch, BlockSize);
+				continue;
+			}
+			if (state.multiLane) {
+				renderLanes(state, *offsets, channels.data(), NumChannels,
+							BlockSize);
+				continue;
+			}
+
+			const auto midiTrigger = has(7);
+			if (midiTrigger) {
+				detectMidiHits(state.detector, midi, 0, BlockSize);
+			}
+			const auto silent =
+				isSilent(channels.data(), NumChannels, BlockSize);
+			const auto keySilent =
+				midiTrigger ? state.detector.events.empty() : silent;
+			if (silent && keySilent && state.pendingSamples == 0 &&
+				!state.detector.open) {
+				if (!midiTrigger) {
+					skipDetector(state.detector, BlockSize);
+				}
+				skipDelay(state, BlockSize);
+				continue;
+			}
+
+			if (!midiTrigger) {
+				runDetector(state.detector, channels.data(),
+							has(8) ? LaneWidth : NumChannels, BlockSize,
+							has(8) ? DetectorKey::Sum : DetectorKey::Loudest);
+			}
+			buildSegments(state, *offsets,
+						  midiTrigger ? DetectorEventType::Onset
+									  : DetectorEventType::Release);
+			renderDelay(state, channels.data(), NumChannels, BlockSize,
+						silent);
+		}
+	}
+}
+
+// Renders every mode in single and double precision inside a RealtimeScope,
+// returning how many allocations or locks that made
+auto checkRealtimeSafety() -> std::size_t {
+	constexpr auto NumChannels = 2 * LaneWidth;
+	constexpr auto BlockSize = 256;
+
+	auto single = preparedState(NumChannels, BlockSize);
+	auto twice = preparedState(NumChannels, BlockSize, true);
+	applyState(*single);
+	applyState(*twice);
+	acquireOffsets(single->generator);
+	acquireOffsets(twice->generator);
+
+	// Quiet gaps between the bursts take the skipping paths too
+	const auto signal = burstSignal(4, 0.f, 11);
+	auto midi = juce::MidiBuffer{};
+	auto scratch = juce::MidiBuffer{};
+	midi.ensureSize(MidiQueueSize * 16);
+	scratch.ensureSize(MidiQueueSize * 16);
+
+	const auto before = realtimeViolations();
+	{
+		const auto realtime = RealtimeScope{};
+		renderEveryMode<float>(*single, signal, midi, scratch);
+		renderEveryMode<double>(*twice, signal, midi, scratch);
+	}
+	return realtimeViolations() - before;
+}
+
+// A seed has to give back the same sequence on every load, and a reseed has to
+// give a different one
+auto checkSeeds() -> bool {
+	const auto a = genFractalOffsets(16, 0.7f, 20, 42);
+	const auto b = genFractalOffsets(16, 0.7f, 20, 42);
+	const auto c = genFractalOffsets(16, 0.7f, 20, 43);
+	return a.offsets == b.offsets && a.offsets != c.offsets;
+}
 
 auto main() -> int {
-	genFractalOffsets(1000, 0.7, 20);
-}
\ No newline at end of file
+	if (!checkSeeds()) {
+		std::cerr << "seeded sequences aren't reproducible" << std::endl;
+		return 1;
+	}
+
+	auto packed = PackedState{};
+	auto state = std::make_unique<State>();
+	std::cout << "packed state: " << benchFalseSharing(packed) << " ns/sample"
+			  << std::endl;
+	std::cout << "split state:  " << benchFalseSharing(*state) << " ns/sample"
+			  << std::endl;
+
+	benchFft();
+	if (const auto error = checkRealFft(); error > 1e-5) {
+		std::cerr << "real fft is off by " << error << std::endl;
+		return 1;
+	}
+
+	if (const auto error = checkOffsetDeviation(); error > 1e-4) {
+		std::cerr << "offset deviation is off by " << error * 100.0 << "%"
+				  << std::endl;
+		return 1;
+	}
+
+	if (const auto error = checkGainDeviation(); error > 1e-4) {
+		std::cerr << "gain deviation is off by " << error * 100.0 << "%"
+				  << std::endl;
+		return 1;
+	}
+
+	if (const auto error = checkStreamDeviation(); error > 0.05) {
+		std::cerr << "streams and tables differ in deviation by "
+				  << error * 100.0 << "%" << std::endl;
+		return 1;
+	}
+
+	if (const auto used = checkOffsetBound(); used > 1.f) {
+		std::cerr << "offsets reach " << used * 100.f
+				  << "% of what the ring is sized for" << std::endl;
+		return 1;
+	}
+
+	if (!checkGeneratorPool()) {
+		std::cerr << "shared generator workers lost or reordered a table"
+				  << std::endl;
+		return 1;
+	}
+
+	if (const auto generated = checkSequenceSharing(); generated != 1) {
+		std::cerr << "shared settings generated " << generated
+				  << " sequences" << std::endl;
+		return 1;
+	}
+
+	if (const auto error = checkDelayKernel(false); error != 0.f) {
+		std::cerr << "delay kernel is off by " << error << std::endl;
+		return 1;
+	}
+	if (const auto error = checkDelayKernel(true); error > 1e-5f) {
+		std::cerr << "fractional delay kernel is off by " << error
+				  << std::endl;
+		return 1;
+	}
+	if (const auto error = checkHitPlacement(); error > 0.05f) {
+		std::cerr << "fractional hits are off by " << error << " samples"
+				  << std::endl;
+		return 1;
+	}
+	if (const auto error = checkFracResponse(10000.f); error > 0.1f) {
+		std::cerr << "fractional taps are " << error
+				  << " dB off flat below 10 kHz" << std::endl;
+		return 1;
+	}
+	if (!checkDetector(false) || !checkDetector(true)) {
+		std::cerr << "detector missed or invented hits" << std::endl;
+		return 1;
+	}
+	if (!checkTimelineChunks(0.f) || !checkTimelineChunks(1e-3f)) {
+		std::cerr << "timeline renders depend on where they start"
+				  << std::endl;
+		return 1;
+	}
+	if (!checkLanes()) {
+		std::cerr << "lanes aren't independent" << std::endl;
+		return 1;
+	}
+	if (!checkMidi()) {
+		std::cerr << "midi notes weren't shifted by their steps" << std::endl;
+		return 1;
+	}
+
+	if (!checkBankQueue()) {
+		std::cerr << "bank requests restarted or piled up" << std::endl;
+		return 1;
+	}
+
+	if (!checkBankIsPreviewOnly()) {
+		std::cerr << "an interpolated table was played" << std::endl;
+		return 1;
+	}
+
+	if (const auto violations = checkRealtimeSafety(); violations > 0) {
+		std::cerr << violations << " realtime violations" << std::endl;
+		return 1;
+	}
+}